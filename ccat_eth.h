@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: MIT */
+/**
+    Userspace interface of the CCAT Ethernet/EtherCAT character device
+    Copyright (C) Beckhoff Automation GmbH & Co. KG
+*/
+
+#ifndef _CCAT_ETH_H_
+#define _CCAT_ETH_H_
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**
+ * /dev/ccat_eth<n> is created for each CCAT Ethernet/EtherCAT function in
+ * DMA mode. The process that opens it (exclusively):
+ * 1. allocates a process image with CCAT_ETH_IOC_PI_ALLOC and mmap()s it
+ * 2. registers datagram mappings with CCAT_ETH_IOC_PI_MAP
+ * 3. read()s a __u64 or poll()s for completed frames
+ * Independent of the process image, raw frames can be sent and received
+ * with io_uring, see CCAT_ETH_URING_SEND.
+ *
+ * Received EtherCAT frames with a registered frame index are no longer
+ * passed to the network stack. Their mapped datagrams are copied from the
+ * DMA memory into the process image and the completion counter returned by
+ * read() is incremented.
+ */
+
+/**
+ * struct ccat_eth_pi_map - copy one datagram of a frame into the process image
+ * @frame_index: index (idx) of the first datagram, identifying the frame
+ * @reserved: must be 0
+ * @datagram_offset: offset of the datagram header, relative to the first
+ *                   datagram header of the frame
+ * @length: number of data bytes in the datagram, frames with a different
+ *          datagram length are skipped
+ * @reserved2: must be 0
+ * @pi_offset: destination of the datagram data in the process image
+ * @wkc_offset: destination of the 16 bit working counter in the process image
+ */
+struct ccat_eth_pi_map {
+	__u8 frame_index;
+	__u8 reserved;
+	__u16 datagram_offset;
+	__u16 length;
+	__u16 reserved2;
+	__u32 pi_offset;
+	__u32 wkc_offset;
+};
+
+/**
+ * struct ccat_eth_pi_table - argument of CCAT_ETH_IOC_PI_MAP
+ * @count: number of entries in maps, 0 disables the scatter
+ * @reserved: must be 0
+ * @maps: userspace address of a struct ccat_eth_pi_map[count]
+ */
+struct ccat_eth_pi_table {
+	__u32 count;
+	__u32 reserved;
+	__u64 maps;
+};
+
+#define CCAT_ETH_PI_MAX_SIZE (16 * 1024 * 1024)
+#define CCAT_ETH_PI_MAX_MAPS 4096
+
+#define CCAT_ETH_IOC_MAGIC 0xCC
+/* allocate a process image of __u32 bytes, once per open() */
+#define CCAT_ETH_IOC_PI_ALLOC _IOW(CCAT_ETH_IOC_MAGIC, 0x01, __u32)
+/* replace all datagram mappings */
+#define CCAT_ETH_IOC_PI_MAP _IOW(CCAT_ETH_IOC_MAGIC, 0x02, struct ccat_eth_pi_table)
+
+/**
+ * io_uring passthrough (IORING_OP_URING_CMD, kernel 6.0 and later): the
+ * operation is selected by sqe->cmd_op, the first 16 bytes of sqe->cmd hold
+ * a struct ccat_eth_uring_cmd. Buffers are plain userspace addresses.
+ *
+ * CCAT_ETH_URING_SEND queues all count frames or none (-ENOBUFS if the tx
+ * fifo is too full) and completes with cqe->res = count, once CCAT has sent
+ * the last of them.
+ *
+ * CCAT_ETH_URING_RECV completes as soon as an EtherCAT frame was received,
+ * with cqe->res = number of frames (up to count) copied. Frames longer than
+ * their buffer are truncated, len returns the number of bytes stored. Only
+ * one RECV may be pending. RECV requires CCAT_ETH_IOC_URING_RX, which
+ * keeps received EtherCAT frames, that are not scattered into the process
+ * image, for RECV instead of passing them to the network stack. If more
+ * than CCAT_ETH_URING_RX_FRAMES are waiting, new ones are dropped.
+ *
+ * Pending commands complete with -ENETDOWN when the interface goes down.
+ * SEND commands, whose frames were still queued when the link came back,
+ * complete with -ENETRESET. From kernel 6.7 pending commands can be
+ * canceled.
+ */
+
+/**
+ * struct ccat_eth_uring_frame - one frame of a SEND or RECV command
+ * @addr: userspace address of the frame data
+ * @len: SEND: length of the frame, RECV: size of the buffer at addr, set
+ *       to the length of the received frame on completion
+ * @reserved: must be 0
+ */
+struct ccat_eth_uring_frame {
+	__u64 addr;
+	__u32 len;
+	__u32 reserved;
+};
+
+/**
+ * struct ccat_eth_uring_cmd - payload of a uring_cmd in sqe->cmd
+ * @frames: userspace address of a struct ccat_eth_uring_frame[count]
+ * @count: number of frames, 1 to CCAT_ETH_URING_MAX_FRAMES
+ * @reserved: must be 0
+ */
+struct ccat_eth_uring_cmd {
+	__u64 frames;
+	__u32 count;
+	__u32 reserved;
+};
+
+#define CCAT_ETH_URING_MAX_FRAMES 32
+#define CCAT_ETH_URING_RX_FRAMES 64
+#define CCAT_ETH_URING_SEND 0x01
+#define CCAT_ETH_URING_RECV 0x02
+
+/**
+ * Divert received EtherCAT frames to CCAT_ETH_URING_RECV (__u32 != 0) or
+ * pass them to the network stack again (0), which completes a pending
+ * RECV with -ECANCELED. Fails with -EBUSY while an in-kernel consumer is
+ * registered for the frames. Closing the device switches it off.
+ */
+#define CCAT_ETH_IOC_URING_RX _IOW(CCAT_ETH_IOC_MAGIC, 0x03, __u32)
+
+#endif /* #ifndef _CCAT_ETH_H_ */
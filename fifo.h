@@ -0,0 +1,333 @@
+/* SPDX-License-Identifier: MIT */
+/**
+    Network Driver for Beckhoff CCAT communication controller
+    Copyright (C) Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+*/
+
+#ifndef _CCAT_FIFO_H_
+#define _CCAT_FIFO_H_
+
+/**
+ * Frame layout and ring index logic of the CCAT Ethernet/EtherCAT fifos.
+ * Besides ccat_netdev, this file is compiled by the userspace ring
+ * benchmark (unittest/fifo_bench.c) against a few shims, so it may only
+ * use the kernel API provided there: fixed width and endian types,
+ * smp_load_acquire()/smp_store_release(), barriers and the
+ * ccat_iowrite32()/ccat_writel_relaxed() accessors of module.h. The
+ * includer provides those before including it.
+ */
+
+struct sk_buff;
+
+struct ccat_dma_frame_hdr {
+	__le32 reserved1;
+	__le32 rx_flags;
+#define CCAT_FRAME_RECEIVED 0x1
+	__le16 length;
+	__le16 reserved3;
+	__le32 tx_flags;
+#define CCAT_FRAME_SENT 0x1
+	__le64 timestamp;
+};
+
+struct ccat_eim_frame_hdr {
+	__le16 length;
+	__le16 reserved3;
+	__le32 tx_flags;
+	__le64 timestamp;
+};
+
+struct ccat_eth_frame {
+	u8 placeholder[0x800];
+};
+
+struct ccat_dma_frame {
+	struct ccat_dma_frame_hdr hdr;
+	u8 data[sizeof(struct ccat_eth_frame) -
+		sizeof(struct ccat_dma_frame_hdr)];
+};
+
+struct ccat_eim_frame {
+	struct ccat_eim_frame_hdr hdr;
+	u8 data[sizeof(struct ccat_eth_frame) -
+		sizeof(struct ccat_eim_frame_hdr)];
+};
+
+#define MAX_PAYLOAD_SIZE \
+	(sizeof(struct ccat_eth_frame) - max(sizeof(struct ccat_dma_frame_hdr), sizeof(struct ccat_eim_frame_hdr)))
+
+/**
+ * struct ccat_dma_mem - CCAT DMA channel configuration
+ * @size: number of bytes in the associated DMA memory
+ * @phys: device-viewed address(physical) of the associated DMA memory
+ * @dev: valid struct device pointer
+ * @base: CPU-viewed address(virtual) of the associated DMA memory
+ */
+struct ccat_dma_mem {
+	size_t size;
+	dma_addr_t phys;
+	struct device *dev;
+	void *base;
+};
+
+/**
+ * Copy kernels used to move frame data between skbs and the DMA rings. The
+ * fastest supported variant for each direction is picked by a short
+ * calibration at probe time.
+ */
+enum ccat_copy_id {
+	CCAT_COPY_MEMCPY,
+	CCAT_COPY_MOVSB,
+	CCAT_COPY_NOCACHE,
+	CCAT_COPY_COUNT
+};
+
+/**
+ * struct ccat_dma/eim/mem
+ * @start: aligned CPU-viewed address(virtual) of the associated memory
+ */
+struct ccat_dma {
+	struct ccat_dma_frame *start;
+};
+
+struct ccat_eim {
+	struct ccat_eim_frame __iomem *start;
+};
+
+struct ccat_mem {
+	struct ccat_eth_frame *start;
+};
+
+/**
+ * struct ccat_eth_fifo - CCAT RX or TX fifo
+ * @ops: function pointer table for dma/eim and rx/tx specific fifo functions
+ * @reg: PCI register address of this fifo
+ * @mask: number of slots in the ring buffer - 1, the slot count is a power of two
+ * @max_slots: number of slots supported by the CCAT function for this fifo
+ * @copy: copy kernel used for the frame data of this fifo (DMA only)
+ * @loopback: tx frames are reflected to rx by napi instead of being sent
+ *            by CCAT (DMA only)
+ * @dma_mem: DMA memory backing this fifo (DMA only)
+ * @mem/dma/eim: information about the associated memory
+ * @head: free running index of the next slot to process. Written by the
+ *        producer (tx: ndo_start_xmit() under tx_lock) or by the consumer
+ *        (rx: napi) of this fifo.
+ * @bytes: number of bytes processed -> reported with ndo_get_stats64()
+ * @dropped: number of dropped frames -> reported with ndo_get_stats64()
+ * @tail: free running index of the oldest slot not yet reclaimed (tx) or
+ *        not yet handed back to CCAT (rx), written by napi only. A tx slot
+ *        belongs to the producer again, as soon as tail passed it.
+ *
+ * head and tail are published with release and read with acquire
+ * semantics. They live on separate cachelines, so the transmitting CPU
+ * and the polling CPU don't steal each others lines.
+ */
+struct ccat_eth_fifo {
+	const struct ccat_eth_fifo_operations *ops;
+	void __iomem *reg;
+	u32 mask;
+	u32 max_slots;
+	enum ccat_copy_id copy;
+	bool loopback;
+	struct ccat_dma_mem dma_mem;
+	union {
+		struct ccat_mem mem;
+		struct ccat_dma dma;
+		struct ccat_eim eim;
+	};
+
+	u32 head ____cacheline_aligned_in_smp;
+	atomic64_t bytes;
+	atomic64_t dropped;
+
+	u32 tail ____cacheline_aligned_in_smp;
+};
+
+/**
+ * struct ccat_eth_fifo_operations
+ * @ready: callback used to test if the frame at head was received (rx)
+ * @sent: callback used to find the index after the last frame sent (tx)
+ * @shallow: callback used to test if a tx fifo accepts best-effort frames
+ * @add: callback used to add the frame at index to this fifo
+ * @refill: callback used to hand the rx slots from tail up to an index back
+ * @frame: callback used to access the frame data at index in place (rx)
+ * @timestamp: callback used to read the CCAT systemtime of the frame at index
+ * @copy_to_skb: callback used to copy from rx fifos to skbs
+ * @skb: callback used to queue skbs into tx fifos
+ */
+struct ccat_eth_fifo_operations {
+	size_t(*ready) (struct ccat_eth_fifo *);
+	u32 (*sent) (struct ccat_eth_fifo *);
+	size_t(*shallow) (struct ccat_eth_fifo *);
+	void (*add) (struct ccat_eth_fifo *, u32);
+	void (*refill) (struct ccat_eth_fifo *, u32);
+	const u8 *(*frame) (struct ccat_eth_fifo *, u32);
+	u64 (*timestamp) (struct ccat_eth_fifo *, u32);
+	union {
+		void (*copy_to_skb) (struct ccat_eth_fifo *, struct sk_buff *,
+				     size_t);
+		void (*skb) (struct ccat_eth_fifo *, struct sk_buff *);
+	} queue;
+};
+
+static inline struct ccat_dma_frame *fifo_dma_slot(const struct ccat_eth_fifo
+						   *const fifo, const u32 index)
+{
+	return fifo->dma.start + (index & fifo->mask);
+}
+
+/**
+ * Number of free slots in a tx fifo, only valid for its producer.
+ * One slot is kept unused: in EIM mode an empty CCAT tx fifo doesn't mean
+ * the MAC is done with the last frame, so it may not be overwritten, yet.
+ */
+static inline u32 ccat_eth_tx_space(const struct ccat_eth_fifo *const fifo)
+{
+	const u32 capacity = fifo->mask ? fifo->mask : 1;
+	const u32 pending = fifo->head - smp_load_acquire(&fifo->tail);
+
+	return capacity - pending;
+}
+
+static inline void ccat_eth_fifo_hw_reset(struct ccat_eth_fifo *const fifo)
+{
+	if (fifo->reg) {
+		ccat_iowrite32(0, fifo->reg + 0x8);
+		wmb();
+	}
+}
+
+/**
+ * Reinitialize a fifo and hand all its slots to CCAT (rx) or mark them
+ * free (tx). The caller has to exclude producer and consumer of the fifo:
+ * rx is owned by napi, tx additionally requires tx_lock.
+ */
+static inline void ccat_eth_fifo_reset(struct ccat_eth_fifo *const fifo)
+{
+	u32 i;
+
+	ccat_eth_fifo_hw_reset(fifo);
+
+	for (i = 0; i <= fifo->mask; ++i)
+		fifo->ops->add(fifo, i);
+	fifo->head = 0;
+	fifo->tail = 0;
+}
+
+/**
+ * Frames leave the tx fifo in order, find the first frame, which wasn't
+ * sent, yet. tail isn't moved, so the sent slots can still be read.
+ */
+static inline u32 fifo_dma_tx_sent(struct ccat_eth_fifo *const fifo)
+{
+	const u32 head = smp_load_acquire(&fifo->head);
+	u32 tail = fifo->tail;
+
+	while (tail != head
+	       && (le32_to_cpu(fifo_dma_slot(fifo, tail)->hdr.tx_flags) &
+		   CCAT_FRAME_SENT))
+		++tail;
+	return tail;
+}
+
+/**
+ * Hand the slots of all frames sent to the producer of a tx fifo
+ */
+static inline void ccat_eth_tx_reclaim(struct ccat_eth_fifo *const fifo)
+{
+	smp_store_release(&fifo->tail, fifo->ops->sent(fifo));
+}
+
+static inline size_t fifo_dma_rx_ready(struct ccat_eth_fifo *const fifo)
+{
+	static const size_t OVERHEAD =
+	    offsetof(struct ccat_dma_frame_hdr, rx_flags);
+	const struct ccat_dma_frame *const frame =
+	    fifo_dma_slot(fifo, fifo->head);
+
+	if (le32_to_cpu(frame->hdr.rx_flags) & CCAT_FRAME_RECEIVED) {
+		size_t len;
+
+		/* don't read length or frame before CCAT finished writing them */
+		dma_rmb();
+		len = le16_to_cpu(frame->hdr.length);
+		return (len < OVERHEAD) ? 0 : len - OVERHEAD;
+	}
+	return 0;
+}
+
+/**
+ * CCAT accepts rx slots one at a time: bit 31 together with the offset of
+ * the slot in the DMA window.
+ */
+static inline u32 fifo_dma_rx_doorbell(const struct ccat_eth_fifo *const fifo,
+				       const u32 index)
+{
+	return (1 << 31) | ((index & fifo->mask) * sizeof(struct ccat_dma_frame));
+}
+
+static inline void ccat_eth_rx_fifo_dma_add(struct ccat_eth_fifo *const fifo,
+				     const u32 index)
+{
+	fifo_dma_slot(fifo, index)->hdr.rx_flags = cpu_to_le32(0);
+	ccat_iowrite32(fifo_dma_rx_doorbell(fifo, index), fifo->reg);
+}
+
+/**
+ * Hand a batch of consumed slots back to CCAT: clear all their flags, make
+ * them visible with a single barrier and ring the doorbell once per slot,
+ * which is the minimum the hardware protocol allows, without further
+ * barriers between the MMIO writes.
+ */
+static inline void fifo_dma_rx_refill(struct ccat_eth_fifo *const fifo, const u32 end)
+{
+	u32 i;
+
+	for (i = fifo->tail; i != end; ++i)
+		fifo_dma_slot(fifo, i)->hdr.rx_flags = cpu_to_le32(0);
+	wmb();
+	for (i = fifo->tail; i != end; ++i)
+		ccat_writel_relaxed(fifo_dma_rx_doorbell(fifo, i), fifo->reg);
+	fifo->tail = end;
+}
+
+static inline void ccat_eth_tx_fifo_dma_add_free(struct ccat_eth_fifo *const fifo,
+					  const u32 index)
+{
+	/* mark frame as ready to use for tx */
+	fifo_dma_slot(fifo, index)->hdr.tx_flags = cpu_to_le32(CCAT_FRAME_SENT);
+}
+
+/**
+ * Value written to the CCAT TX-FIFO to send the frame in a DMA slot
+ */
+static inline u32 fifo_dma_tx_doorbell(const struct ccat_eth_fifo *const fifo,
+				       const struct ccat_dma_frame *const frame,
+				       const size_t len)
+{
+	/* CCAT ignores the first 8 bytes of the tx descriptor */
+	u32 addr_and_length = offsetof(struct ccat_dma_frame_hdr, length);
+
+	addr_and_length += ((void *)frame - (void *)fifo->dma.start);
+	addr_and_length += ((len + sizeof(struct ccat_dma_frame_hdr)) / 8) << 24;
+	return addr_and_length;
+}
+
+/**
+ * Claim the slot at head of a tx fifo for a frame of len bytes. The caller
+ * copies the frame data and rings fifo_dma_tx_doorbell().
+ */
+static inline struct ccat_dma_frame *fifo_dma_tx_prepare(const struct
+							 ccat_eth_fifo
+							 *const fifo,
+							 const size_t len)
+{
+	struct ccat_dma_frame *const frame = fifo_dma_slot(fifo, fifo->head);
+
+	frame->hdr.tx_flags = cpu_to_le32(0);
+	frame->hdr.length = cpu_to_le16(len);
+	return frame;
+}
+
+#endif /* #ifndef _CCAT_FIFO_H_ */
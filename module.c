@@ -5,11 +5,18 @@
     Author: Patrick Bruenn <p.bruenn@beckhoff.com>
 */
 
+#include <linux/debugfs.h>
 #include <linux/etherdevice.h>
+#include <linux/interrupt.h>
+#include <linux/io-64-nonatomic-lo-hi.h>
 #include <linux/module.h>
 #include <linux/netdevice.h>
 #include <linux/platform_device.h>
 #include <linux/mfd/core.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+#include <linux/topology.h>
+#include <linux/uaccess.h>
 #include <linux/version.h>
 #include "module.h"
 
@@ -18,6 +25,13 @@ MODULE_AUTHOR("Patrick Bruenn <p.bruenn@beckhoff.com>");
 MODULE_LICENSE("GPL and additional rights");
 MODULE_VERSION(DRV_VERSION);
 
+static unsigned int mmio_bench_rounds = 1024;
+module_param(mmio_bench_rounds, uint, 0644);
+MODULE_PARM_DESC(mmio_bench_rounds,
+		 "accesses per measurement of the debugfs mmio_bench (default: 1024)");
+
+static struct dentry *ccat_debugfs;
+
 static struct ccat_cell ccat_cells[] = {
 	{
 	 .type = CCATINFO_ETHERCAT_NODMA,
@@ -155,25 +169,46 @@ int ccat_cdev_open(struct inode *const i, struct file *const f)
 
 EXPORT_SYMBOL(ccat_cdev_open);
 
-int ccat_cdev_probe(struct ccat_function *func, struct ccat_class *cdev_class,
-		    size_t iosize)
+/**
+ * Create a character device for a CCAT function, without claiming the
+ * functions private_data, which is left to the caller. private_data is
+ * attached to the ccat_cdev before the device becomes visible.
+ */
+struct ccat_cdev *ccat_cdev_add(struct ccat_function *func,
+				struct ccat_class *cdev_class, size_t iosize,
+				void *private_data)
 {
 	struct ccat_cdev *const ccdev = alloc_ccat_cdev(cdev_class);
 	if (!ccdev) {
-		return -ENOMEM;
+		return NULL;
 	}
 
 	ccdev->ioaddr = func->ccat->bar_0 + func->info.addr;
 	ccdev->iosize = iosize;
+	ccdev->private_data = private_data;
 	atomic_set(&ccdev->in_use, 1);
 
 	if (ccat_cdev_init
 	    (&ccdev->cdev, ccdev->dev, cdev_class->class, &cdev_class->fops)) {
-		pr_warn("ccat_cdev_probe() failed\n");
+		pr_warn("ccat_cdev_add() failed\n");
 		free_ccat_cdev(ccdev);
-		return -1;
+		return NULL;
 	}
 	ccdev->class = cdev_class;
+	return ccdev;
+}
+
+EXPORT_SYMBOL(ccat_cdev_add);
+
+int ccat_cdev_probe(struct ccat_function *func, struct ccat_class *cdev_class,
+		    size_t iosize)
+{
+	struct ccat_cdev *const ccdev =
+	    ccat_cdev_add(func, cdev_class, iosize, NULL);
+	if (!ccdev) {
+		pr_warn("ccat_cdev_probe() failed\n");
+		return -1;
+	}
 	func->private_data = ccdev;
 	return 0;
 }
@@ -192,14 +227,21 @@ int ccat_cdev_release(struct inode *const i, struct file *const f)
 
 EXPORT_SYMBOL(ccat_cdev_release);
 
+void ccat_cdev_del(struct ccat_cdev *ccdev)
+{
+	cdev_del(&ccdev->cdev);
+	device_destroy(ccdev->class->class, ccdev->dev);
+	free_ccat_cdev(ccdev);
+}
+
+EXPORT_SYMBOL(ccat_cdev_del);
+
 REMOVE_RESULT ccat_cdev_remove(struct platform_device *pdev)
 {
 	struct ccat_function *const func = pdev->dev.platform_data;
 	struct ccat_cdev *const ccdev = func->private_data;
 
-	cdev_del(&ccdev->cdev);
-	device_destroy(ccdev->class->class, ccdev->dev);
-	free_ccat_cdev(ccdev);
+	ccat_cdev_del(ccdev);
 	return REMOVE_OK;
 }
 
@@ -222,6 +264,279 @@ static int ccat_function_connect(struct ccat_function
 	return 0;
 }
 
+/**
+ * MMIO access benchmark, run by reading <debugfs>/ccat/<device>/mmio_bench.
+ * Each access width and block copy size is timed against the start of the
+ * register window of every function found in the information blocks and
+ * against the DMA channel table in BAR2. Only reads are timed, except on
+ * SRAM, where every write stores the value read from the same address
+ * before, so its content survives. Meanwhile the SRAM cdev is claimed
+ * like by open(), SRAM writes are skipped while it is open.
+ */
+#define CCAT_BENCH_BATCH 16
+#define CCAT_BENCH_MAX_COPY 2048
+#define CCAT_BENCH_BAR2_OFFSET 0x1000
+#define CCAT_BENCH_BAR2_SIZE 64
+
+struct ccat_bench_op {
+	const char *name;
+	size_t len;
+	bool write;
+	void (*fn) (void __iomem * addr, void *buf, size_t len);
+};
+
+static void ccat_bench_read8(void __iomem * addr, void *buf, size_t len)
+{
+	*(u8 *) buf = ioread8(addr);
+}
+
+static void ccat_bench_read16(void __iomem * addr, void *buf, size_t len)
+{
+	*(u16 *) buf = ioread16(addr);
+}
+
+static void ccat_bench_read32(void __iomem * addr, void *buf, size_t len)
+{
+	*(u32 *) buf = ioread32(addr);
+}
+
+static void ccat_bench_read64(void __iomem * addr, void *buf, size_t len)
+{
+	*(u64 *) buf = readq(addr);
+}
+
+static void ccat_bench_copy_from(void __iomem * addr, void *buf, size_t len)
+{
+	memcpy_fromio(buf, addr, len);
+}
+
+static void ccat_bench_write8(void __iomem * addr, void *buf, size_t len)
+{
+	iowrite8(*(u8 *) buf, addr);
+}
+
+static void ccat_bench_write16(void __iomem * addr, void *buf, size_t len)
+{
+	iowrite16(*(u16 *) buf, addr);
+}
+
+static void ccat_bench_write32(void __iomem * addr, void *buf, size_t len)
+{
+	iowrite32(*(u32 *) buf, addr);
+}
+
+static void ccat_bench_write64(void __iomem * addr, void *buf, size_t len)
+{
+	writeq(*(u64 *) buf, addr);
+}
+
+static void ccat_bench_copy_to(void __iomem * addr, void *buf, size_t len)
+{
+	memcpy_toio(addr, buf, len);
+}
+
+/* a len of 0 marks block copies, timed with each of ccat_bench_sizes */
+static const struct ccat_bench_op ccat_bench_ops[] = {
+	{"ioread8", 1, false, ccat_bench_read8},
+	{"ioread16", 2, false, ccat_bench_read16},
+	{"ioread32", 4, false, ccat_bench_read32},
+	{"readq", 8, false, ccat_bench_read64},
+	{"memcpy_fromio", 0, false, ccat_bench_copy_from},
+	{"iowrite8", 1, true, ccat_bench_write8},
+	{"iowrite16", 2, true, ccat_bench_write16},
+	{"iowrite32", 4, true, ccat_bench_write32},
+	{"writeq", 8, true, ccat_bench_write64},
+	{"memcpy_toio", 0, true, ccat_bench_copy_to},
+};
+
+static const size_t ccat_bench_sizes[] = { 64, 256, 1024, CCAT_BENCH_MAX_COPY };
+
+/**
+ * Time one access in batches, with preemption disabled only per batch, as
+ * a single uncached read can take microseconds.
+ */
+static void ccat_bench_measure(struct seq_file *s, const char *region,
+			       const struct ccat_bench_op *op,
+			       void __iomem * addr, void *buf, size_t len)
+{
+	const unsigned int rounds = max(READ_ONCE(mmio_bench_rounds), 1U);
+	u64 ns = 0, start;
+	unsigned int i, n;
+
+	for (i = 0; i < rounds; i += CCAT_BENCH_BATCH) {
+		preempt_disable();
+		start = ktime_get_ns();
+		for (n = 0; n < CCAT_BENCH_BATCH; ++n)
+			op->fn(addr, buf, len);
+		ns += ktime_get_ns() - start;
+		preempt_enable();
+		cond_resched();
+	}
+	ns = max_t(u64, ns, 1);
+	seq_printf(s, "%-16s %-14s %5zu %10llu.%llu %10llu\n", region, op->name,
+		   len, div_u64(ns, i), div_u64(ns * 10, i) % 10,
+		   div64_u64((u64) len * i * 1000, ns));
+}
+
+static void ccat_bench_region(struct seq_file *s, const char *region,
+			      void __iomem * addr, size_t size,
+			      const bool writable, void *buf)
+{
+	const struct ccat_bench_op *op;
+	size_t i;
+
+	size = min_t(size_t, size, CCAT_BENCH_MAX_COPY);
+	/* writes store what was read before */
+	memcpy_fromio(buf, addr, size);
+	for (op = ccat_bench_ops; op < ccat_bench_ops + ARRAY_SIZE(ccat_bench_ops);
+	     ++op) {
+		if (op->write && !writable)
+			continue;
+		if (op->len) {
+			if (op->len <= size)
+				ccat_bench_measure(s, region, op, addr, buf,
+						   op->len);
+			continue;
+		}
+		for (i = 0; i < ARRAY_SIZE(ccat_bench_sizes); ++i) {
+			if (ccat_bench_sizes[i] <= size)
+				ccat_bench_measure(s, region, op, addr, buf,
+						   ccat_bench_sizes[i]);
+		}
+	}
+}
+
+static int ccat_bench_match_sram(struct device *dev, void *data)
+{
+	const struct ccat_function *const func = dev_get_platdata(dev);
+
+	return func && CCATINFO_SRAM == func->info.type
+	    && func->index == *(const unsigned int *)data;
+}
+
+/**
+ * Find the SRAM function device of information block index and lock it,
+ * so ccat_sram can't bind or unbind during the benchmark. If ccat_sram is
+ * bound, its cdev is claimed, which fails while it is open.
+ * @writable: set if nobody else can write to the SRAM
+ * @return the locked device or NULL
+ */
+static struct device *ccat_bench_claim_sram(struct ccat_device *const ccatdev,
+					    unsigned int index, bool *writable)
+{
+	struct device *const dev =
+	    device_find_child(ccatdev->dev, &index, ccat_bench_match_sram);
+	const struct ccat_function *func;
+	struct ccat_cdev *ccdev;
+
+	*writable = false;
+	if (!dev)
+		return NULL;
+
+	device_lock(dev);
+	func = dev_get_platdata(dev);
+	ccdev = dev->driver ? func->private_data : NULL;
+	if (!ccdev) {
+		*writable = true;
+	} else if (atomic_dec_and_test(&ccdev->in_use)) {
+		*writable = true;
+	} else {
+		atomic_inc(&ccdev->in_use);
+	}
+	return dev;
+}
+
+static void ccat_bench_release_sram(struct device *const dev,
+				    const bool writable)
+{
+	const struct ccat_function *const func = dev_get_platdata(dev);
+
+	if (writable && dev->driver && func->private_data) {
+		struct ccat_cdev *const ccdev = func->private_data;
+
+		atomic_inc(&ccdev->in_use);
+	}
+	device_unlock(dev);
+	put_device(dev);
+}
+
+static const char *ccat_function_name(const u16 type)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ccat_cells); ++i) {
+		if (type == ccat_cells[i].type)
+			return ccat_cells[i].cell.name;
+	}
+	return NULL;
+}
+
+static int ccat_bench_show(struct seq_file *s, void *unused)
+{
+	static const size_t block_size = sizeof(struct ccat_info_block);
+	struct ccat_device *const ccatdev = s->private;
+	const u8 num_func = ioread8(ccatdev->bar_0 + 4);
+	void *const buf = kmalloc(CCAT_BENCH_MAX_COPY, GFP_KERNEL);
+	struct ccat_info_block info;
+	char region[32];
+	u8 i;
+
+	if (!buf)
+		return -ENOMEM;
+
+	seq_printf(s, "%-16s %-14s %5s %12s %10s\n", "region", "access",
+		   "bytes", "ns/access", "MB/s");
+	/* the first block describes the information blocks themselves */
+	ccat_bench_region(s, "bar0_info", ccatdev->bar_0, block_size * num_func,
+			  false, buf);
+	for (i = 1; i < num_func; ++i) {
+		struct device *sram = NULL;
+		bool writable = false;
+		const char *name;
+
+		memcpy_fromio(&info, ccatdev->bar_0 + block_size * i,
+			      sizeof(info));
+		if (CCATINFO_NOTUSED == info.type || !info.size)
+			continue;
+		name = ccat_function_name(info.type);
+		if (name)
+			snprintf(region, sizeof(region), "%s", name);
+		else
+			snprintf(region, sizeof(region), "type_0x%04x", info.type);
+		if (CCATINFO_SRAM == info.type)
+			sram = ccat_bench_claim_sram(ccatdev, i, &writable);
+		ccat_bench_region(s, region, ccatdev->bar_0 + info.addr,
+				  info.size, writable, buf);
+		if (sram)
+			ccat_bench_release_sram(sram, writable);
+	}
+	if (ccatdev->bar_2)
+		ccat_bench_region(s, "bar2_dma",
+				  ccatdev->bar_2 + CCAT_BENCH_BAR2_OFFSET,
+				  CCAT_BENCH_BAR2_SIZE, false, buf);
+	kfree(buf);
+	return 0;
+}
+
+static int ccat_bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ccat_bench_show, inode->i_private);
+}
+
+static const struct file_operations ccat_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = ccat_bench_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void ccat_functions_remove(struct ccat_device *const ccatdev)
+{
+	debugfs_remove_recursive(ccatdev->debugfs);
+	mfd_remove_devices(ccatdev->dev);
+}
+
 /**
  * Initialize all available CCAT functions.
  *
@@ -230,28 +545,60 @@ static int ccat_function_connect(struct ccat_function
 static int ccat_functions_init(struct ccat_device *const ccatdev)
 {
 	static const size_t block_size = sizeof(struct ccat_info_block);
-	struct ccat_function *next = kzalloc(sizeof(*next), GFP_KERNEL);
+	const int node = dev_to_node(ccatdev->dev);
+	struct ccat_function *next = kzalloc_node(sizeof(*next), GFP_KERNEL, node);
 	void __iomem *addr = ccatdev->bar_0; /** first block is the CCAT information block entry */
 	const u8 num_func = ioread8(addr + 4); /** number of CCAT function blocks is at offset 0x4 */
 	const void __iomem *end = addr + (block_size * num_func);
 	int ret = 0;
 
 	pr_info("CCAT date: %04d-%02d-%02d\n", 2000 + ioread8(addr + 7), ioread8(addr + 6), ioread8(addr + 5));
+	ccatdev->debugfs = debugfs_create_dir(dev_name(ccatdev->dev), ccat_debugfs);
+	debugfs_create_file("mmio_bench", 0400, ccatdev->debugfs, ccatdev,
+			    &ccat_bench_fops);
 	for (; addr < end && next; addr += block_size) {
 		memcpy_fromio(&next->info, addr, sizeof(next->info));
 		if (CCATINFO_NOTUSED != next->info.type) {
 			next->ccat = ccatdev;
+			next->index = (addr - ccatdev->bar_0) / block_size;
 			ret = ccat_function_connect(next, ccatdev);
 			if (ret < 0) {
 				return ret;
 			}
-			next = kzalloc(sizeof(*next), GFP_KERNEL);
+			next = kzalloc_node(sizeof(*next), GFP_KERNEL, node);
 		}
 	}
 	kfree(next);
 	return 0;
 }
 
+/**
+ * ccat_device_add() - register the functions of a CCAT mapped elsewhere
+ * @ccatdev: CCAT with dev, bar_0 and (optional) bar_2 initialized
+ *
+ * Used by bus drivers outside of this module, like the ccat_sim simulator,
+ * to attach the function drivers to their CCAT.
+ *
+ * Return: 0 or a negative errno
+ */
+int ccat_device_add(struct ccat_device *ccatdev)
+{
+	return ccat_functions_init(ccatdev);
+}
+
+EXPORT_SYMBOL(ccat_device_add);
+
+/**
+ * ccat_device_remove() - unregister the functions added by ccat_device_add()
+ * @ccatdev: CCAT passed to ccat_device_add()
+ */
+void ccat_device_remove(struct ccat_device *ccatdev)
+{
+	ccat_functions_remove(ccatdev);
+}
+
+EXPORT_SYMBOL(ccat_device_remove);
+
 #ifdef CONFIG_PCI
 static int ccat_pci_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 {
@@ -329,7 +676,7 @@ static void ccat_pci_remove(struct pci_dev *pdev)
 	struct ccat_device *ccatdev = pci_get_drvdata(pdev);
 
 	if (ccatdev) {
-		mfd_remove_devices(ccatdev->dev);
+		ccat_functions_remove(ccatdev);
 		if (ccatdev->bar_2)
 			pci_iounmap(pdev, ccatdev->bar_2);
 		pci_iounmap(pdev, ccatdev->bar_0);
@@ -355,7 +702,6 @@ static struct pci_driver ccat_pci_driver = {
 	.remove = ccat_pci_remove,
 };
 
-module_pci_driver(ccat_pci_driver);
 
 #else /* #ifdef CONFIG_PCI */
 static const size_t CCAT_EIM_ADDR = 0xf0000000;
@@ -397,7 +743,7 @@ static int ccat_eim_remove(struct platform_device *pdev)
 	struct ccat_device *ccatdev = platform_get_drvdata(pdev);
 
 	if (ccatdev) {
-		mfd_remove_devices(ccatdev->dev);
+		ccat_functions_remove(ccatdev);
 		iounmap(ccatdev->bar_0);
 		release_mem_region(CCAT_EIM_ADDR, CCAT_EIM_LEN);
 	}
@@ -420,5 +766,245 @@ static struct platform_driver ccat_eim_driver = {
 	.remove = ccat_eim_remove,
 };
 
-module_platform_driver(ccat_eim_driver);
 #endif /* #ifdef CONFIG_PCI */
+
+#ifdef CCAT_MMIO_PROFILE
+#define CCAT_MMIO_SITES 256
+/* the last entry collects all sites, which didn't fit */
+#define CCAT_MMIO_OTHER (CCAT_MMIO_SITES - 1)
+
+struct ccat_mmio_stat {
+	u64 count;
+	u64 cycles;
+};
+
+/**
+ * struct ccat_mmio_entry - copy of a ccat_mmio_site, which outlives the
+ * module containing the site, so reloading it reuses the same entry
+ */
+struct ccat_mmio_entry {
+	char func[48];
+	char op[24];
+	unsigned int line;
+};
+
+struct ccat_mmio_rank {
+	unsigned int id;
+	struct ccat_mmio_stat stat;
+};
+
+DEFINE_STATIC_KEY_FALSE(ccat_mmio_profile_key);
+
+EXPORT_SYMBOL(ccat_mmio_profile_key);
+
+static struct ccat_mmio_stat __percpu *ccat_mmio_stats;
+static struct ccat_mmio_entry ccat_mmio_entries[CCAT_MMIO_SITES];
+static unsigned int ccat_mmio_used;
+static DEFINE_SPINLOCK(ccat_mmio_lock);
+
+static int ccat_mmio_register(struct ccat_mmio_site *site)
+{
+	unsigned long flags;
+	unsigned int id;
+
+	spin_lock_irqsave(&ccat_mmio_lock, flags);
+	for (id = 0; id < ccat_mmio_used; ++id) {
+		const struct ccat_mmio_entry *const e = &ccat_mmio_entries[id];
+
+		if (e->line == site->line && !strcmp(e->op, site->op)
+		    && !strncmp(e->func, site->func, sizeof(e->func) - 1))
+			break;
+	}
+	if (id == ccat_mmio_used) {
+		if (id < CCAT_MMIO_OTHER) {
+			strscpy(ccat_mmio_entries[id].func, site->func,
+				sizeof(ccat_mmio_entries[id].func));
+			strscpy(ccat_mmio_entries[id].op, site->op,
+				sizeof(ccat_mmio_entries[id].op));
+			ccat_mmio_entries[id].line = site->line;
+			++ccat_mmio_used;
+		} else {
+			id = CCAT_MMIO_OTHER;
+		}
+	}
+	WRITE_ONCE(site->id, id);
+	spin_unlock_irqrestore(&ccat_mmio_lock, flags);
+	return id;
+}
+
+/**
+ * ccat_mmio_account() - add one access of a site to the profile
+ * @site: call site of the access
+ * @cycles: get_cycles() spent in the access
+ */
+void ccat_mmio_account(struct ccat_mmio_site *site, u64 cycles)
+{
+	int id = READ_ONCE(site->id);
+
+	if (unlikely(id < 0))
+		id = ccat_mmio_register(site);
+	this_cpu_inc(ccat_mmio_stats[id].count);
+	this_cpu_add(ccat_mmio_stats[id].cycles, cycles);
+}
+
+EXPORT_SYMBOL(ccat_mmio_account);
+
+static int ccat_mmio_rank_cmp(const void *a, const void *b)
+{
+	const struct ccat_mmio_rank *const x = a;
+	const struct ccat_mmio_rank *const y = b;
+
+	return (x->stat.cycles < y->stat.cycles) -
+	    (x->stat.cycles > y->stat.cycles);
+}
+
+static int ccat_mmio_profile_show(struct seq_file *s, void *unused)
+{
+	const unsigned int used = READ_ONCE(ccat_mmio_used);
+	struct ccat_mmio_rank *const ranks =
+	    kcalloc(CCAT_MMIO_SITES, sizeof(*ranks), GFP_KERNEL);
+	unsigned int id, n = 0;
+	int cpu;
+
+	if (!ranks)
+		return -ENOMEM;
+
+	for (id = 0; id < CCAT_MMIO_SITES; ++id) {
+		if (id >= used && id != CCAT_MMIO_OTHER)
+			continue;
+		ranks[n].id = id;
+		for_each_possible_cpu(cpu) {
+			const struct ccat_mmio_stat *const stat =
+			    per_cpu_ptr(ccat_mmio_stats, cpu) + id;
+
+			ranks[n].stat.count += stat->count;
+			ranks[n].stat.cycles += stat->cycles;
+		}
+		if (ranks[n].stat.count)
+			++n;
+	}
+	sort(ranks, n, sizeof(*ranks), ccat_mmio_rank_cmp, NULL);
+
+	seq_printf(s, "profiling %s\n%14s %12s %10s %-20s %s\n",
+		   static_key_enabled(&ccat_mmio_profile_key) ? "on" : "off",
+		   "cycles", "count", "cycles/op", "access", "site");
+	for (id = 0; id < n; ++id) {
+		const struct ccat_mmio_entry *const e =
+		    &ccat_mmio_entries[ranks[id].id];
+
+		seq_printf(s, "%14llu %12llu %10llu %-20s %s:%u\n",
+			   ranks[id].stat.cycles, ranks[id].stat.count,
+			   div64_u64(ranks[id].stat.cycles,
+				     ranks[id].stat.count),
+			   ranks[id].id == CCAT_MMIO_OTHER ? "-" : e->op,
+			   ranks[id].id == CCAT_MMIO_OTHER ? "(other)" : e->func,
+			   e->line);
+	}
+	kfree(ranks);
+	return 0;
+}
+
+static int ccat_mmio_profile_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ccat_mmio_profile_show, inode->i_private);
+}
+
+/**
+ * Accepts "on" and "off" to switch profiling and "reset" to clear the
+ * counters. A reset while profiling may miss concurrent increments.
+ */
+static ssize_t ccat_mmio_profile_write(struct file *file,
+				       const char __user * ubuf, size_t len,
+				       loff_t * ppos)
+{
+	char cmd[8];
+	int cpu;
+
+	if (len >= sizeof(cmd))
+		return -EINVAL;
+	if (copy_from_user(cmd, ubuf, len))
+		return -EFAULT;
+	cmd[len] = '\0';
+
+	if (sysfs_streq(cmd, "on")) {
+		static_branch_enable(&ccat_mmio_profile_key);
+	} else if (sysfs_streq(cmd, "off")) {
+		static_branch_disable(&ccat_mmio_profile_key);
+	} else if (sysfs_streq(cmd, "reset")) {
+		for_each_possible_cpu(cpu)
+		    memset(per_cpu_ptr(ccat_mmio_stats, cpu), 0,
+			   sizeof(struct ccat_mmio_stat) * CCAT_MMIO_SITES);
+	} else {
+		return -EINVAL;
+	}
+	return len;
+}
+
+static const struct file_operations ccat_mmio_profile_fops = {
+	.owner = THIS_MODULE,
+	.open = ccat_mmio_profile_open,
+	.read = seq_read,
+	.write = ccat_mmio_profile_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void ccat_mmio_profile_init(void)
+{
+	ccat_mmio_stats =
+	    __alloc_percpu(sizeof(struct ccat_mmio_stat) * CCAT_MMIO_SITES,
+			   __alignof__(struct ccat_mmio_stat));
+	if (!ccat_mmio_stats) {
+		pr_warn("no memory for the MMIO profile.\n");
+		return;
+	}
+	debugfs_create_file("mmio_profile", 0600, ccat_debugfs, NULL,
+			    &ccat_mmio_profile_fops);
+}
+
+static void ccat_mmio_profile_exit(void)
+{
+	static_branch_disable(&ccat_mmio_profile_key);
+	free_percpu(ccat_mmio_stats);
+}
+#else
+static inline void ccat_mmio_profile_init(void)
+{
+}
+
+static inline void ccat_mmio_profile_exit(void)
+{
+}
+#endif /* #ifdef CCAT_MMIO_PROFILE */
+
+static int __init ccat_init(void)
+{
+	int status;
+
+	ccat_debugfs = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	ccat_mmio_profile_init();
+#ifdef CONFIG_PCI
+	status = pci_register_driver(&ccat_pci_driver);
+#else
+	status = platform_driver_register(&ccat_eim_driver);
+#endif
+	if (status) {
+		debugfs_remove_recursive(ccat_debugfs);
+		ccat_mmio_profile_exit();
+	}
+	return status;
+}
+
+static void __exit ccat_exit(void)
+{
+#ifdef CONFIG_PCI
+	pci_unregister_driver(&ccat_pci_driver);
+#else
+	platform_driver_unregister(&ccat_eim_driver);
+#endif
+	debugfs_remove_recursive(ccat_debugfs);
+	ccat_mmio_profile_exit();
+}
+
+module_init(ccat_init);
+module_exit(ccat_exit);
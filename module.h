@@ -74,6 +74,7 @@ struct ccat_cdev {
 	dev_t dev;
 	struct cdev cdev;
 	struct ccat_class *class;
+	void *private_data;
 };
 
 /**
@@ -92,12 +93,84 @@ extern int ccat_cdev_open(struct inode *const i, struct file *const f);
 extern int ccat_cdev_release(struct inode *const i, struct file *const f);
 extern loff_t ccat_cdev_llseek(struct file *f, loff_t offset, int whence);
 
+/**
+ * MMIO accessors of the CCAT function drivers. With -DCCAT_MMIO_PROFILE
+ * every call site counts its accesses and the cycles spent in them per
+ * CPU, once enabled through <debugfs>/ccat/mmio_profile. Otherwise they
+ * are the plain kernel accessors.
+ */
+#ifdef CCAT_MMIO_PROFILE
+#include <linux/jump_label.h>
+#include <linux/timex.h>
+
+/**
+ * struct ccat_mmio_site - one profiled MMIO access in the source
+ * @func: function containing the access
+ * @op: accessor
+ * @line: source line of the access
+ * @id: entry in the profile, assigned on first use
+ */
+struct ccat_mmio_site {
+	const char *func;
+	const char *op;
+	unsigned int line;
+	int id;
+};
+
+DECLARE_STATIC_KEY_FALSE(ccat_mmio_profile_key);
+extern void ccat_mmio_account(struct ccat_mmio_site *site, u64 cycles);
+
+#define ccat_mmio_read(accessor, ...) ({				\
+	static struct ccat_mmio_site __site = {				\
+		__func__, #accessor, __LINE__, -1			\
+	};								\
+	typeof(accessor(__VA_ARGS__)) __val;				\
+	if (static_branch_unlikely(&ccat_mmio_profile_key)) {		\
+		const cycles_t __start = get_cycles();			\
+		__val = accessor(__VA_ARGS__);				\
+		ccat_mmio_account(&__site, get_cycles() - __start);	\
+	} else {							\
+		__val = accessor(__VA_ARGS__);				\
+	}								\
+	__val;								\
+})
+
+#define ccat_mmio_write(accessor, ...) do {				\
+	static struct ccat_mmio_site __site = {				\
+		__func__, #accessor, __LINE__, -1			\
+	};								\
+	if (static_branch_unlikely(&ccat_mmio_profile_key)) {		\
+		const cycles_t __start = get_cycles();			\
+		accessor(__VA_ARGS__);					\
+		ccat_mmio_account(&__site, get_cycles() - __start);	\
+	} else {							\
+		accessor(__VA_ARGS__);					\
+	}								\
+} while (0)
+#else
+#define ccat_mmio_read(accessor, ...) accessor(__VA_ARGS__)
+#define ccat_mmio_write(accessor, ...) accessor(__VA_ARGS__)
+#endif /* #ifdef CCAT_MMIO_PROFILE */
+
+#define ccat_ioread8(addr) ccat_mmio_read(ioread8, addr)
+#define ccat_ioread16(addr) ccat_mmio_read(ioread16, addr)
+#define ccat_ioread32(addr) ccat_mmio_read(ioread32, addr)
+#define ccat_iowrite8(val, addr) ccat_mmio_write(iowrite8, val, addr)
+#define ccat_iowrite16(val, addr) ccat_mmio_write(iowrite16, val, addr)
+#define ccat_iowrite32(val, addr) ccat_mmio_write(iowrite32, val, addr)
+#define ccat_writel_relaxed(val, addr) ccat_mmio_write(writel_relaxed, val, addr)
+#define ccat_memcpy_fromio(dst, src, len) \
+	ccat_mmio_write(memcpy_fromio, dst, src, len)
+#define ccat_memcpy_toio(dst, src, len) \
+	ccat_mmio_write(memcpy_toio, dst, src, len)
+
 /**
  * struct ccat_device - CCAT device representation
  * @pdev: pointer to the pci object allocated by the kernel
  * @dev: pointer to the device object allocated by the kernel
  * @bar_0: holding information about PCI BAR 0
  * @bar_2: holding information about PCI BAR 2 (optional)
+ * @debugfs: debugfs directory of this CCAT
  *
  * One instance of a ccat_device should represent a physical CCAT. Since
  * a CCAT is implemented as FPGA the available functions can vary.
@@ -107,8 +180,12 @@ struct ccat_device {
 	void *dev;
 	void __iomem *bar_0;
 	void __iomem *bar_2;
+	struct dentry *debugfs;
 };
 
+extern int ccat_device_add(struct ccat_device *ccatdev);
+extern void ccat_device_remove(struct ccat_device *ccatdev);
+
 struct ccat_info_block {
 	u16 type;
 	u16 rev;
@@ -133,9 +210,17 @@ struct ccat_info_block {
 	u32 size;
 };
 
+/**
+ * struct ccat_function - CCAT function passed to the function drivers
+ * @ccat: the CCAT this function belongs to
+ * @info: copy of the information block of this function
+ * @index: number of the information block of this function
+ * @private_data: used by the function driver
+ */
 struct ccat_function {
 	struct ccat_device *ccat;
 	struct ccat_info_block info;
+	unsigned int index;
 	void *private_data;
 };
 
@@ -152,5 +237,34 @@ struct ccat_class {
 extern REMOVE_RESULT ccat_cdev_remove(struct platform_device *pdev);
 extern int ccat_cdev_probe(struct ccat_function *func,
 			   struct ccat_class *cdev_class, size_t iosize);
+extern struct ccat_cdev *ccat_cdev_add(struct ccat_function *func,
+				       struct ccat_class *cdev_class,
+				       size_t iosize, void *private_data);
+extern void ccat_cdev_del(struct ccat_cdev *ccdev);
+
+/**
+ * TX frame templates of the CCAT Ethernet/EtherCAT function in DMA mode,
+ * exported by ccat_netdev. Templates stay resident in tx DMA slots, so a
+ * cyclic frame is sent by patching the changed bytes and a single write
+ * to the CCAT TX-FIFO.
+ */
+struct net_device;
+extern int ccat_eth_template_add(struct net_device *dev, const void *data,
+				 size_t len);
+extern int ccat_eth_template_patch(struct net_device *dev, unsigned int id,
+				   size_t offset, const void *data, size_t len);
+extern int ccat_eth_template_send(struct net_device *dev, unsigned int id);
+extern int ccat_eth_template_remove(struct net_device *dev, unsigned int id);
+
+/**
+ * Kernel consumer of one EtherType received by the CCAT Ethernet/EtherCAT
+ * function in DMA mode, exported by ccat_netdev. Matching frames are
+ * passed straight from the rx DMA slot, without an skb.
+ */
+typedef void (*ccat_eth_rx_handler_t)(void *ctx, const void *frame,
+				      size_t len);
+extern int ccat_eth_rx_register(struct net_device *dev, u16 proto,
+				ccat_eth_rx_handler_t handler, void *ctx);
+extern void ccat_eth_rx_unregister(struct net_device *dev);
 
 #endif /* #ifndef _CCAT_H_ */
@@ -5,13 +5,45 @@
     Author: Patrick Bruenn <p.bruenn@beckhoff.com>
 */
 
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
 #include <linux/etherdevice.h>
+#include <linux/ethtool.h>
 #include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/netdevice.h>
+#include <linux/poll.h>
+#include <linux/rcupdate.h>
+#include <linux/rtnetlink.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/topology.h>
+#include <linux/uaccess.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <net/pkt_sched.h>
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+#define CCAT_ETH_URING
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring.h>
+#else
+#include <linux/io_uring/cmd.h>
+#endif
+#endif
 
+#include "ccat_eth.h"
 #include "module.h"
+#include "fifo.h"
 
 MODULE_DESCRIPTION(DRV_DESCRIPTION);
 MODULE_AUTHOR("Patrick Bruenn <p.bruenn@beckhoff.com>");
@@ -36,45 +68,129 @@ static const u8 frameForwardEthernetFrames[] = {
 };
 
 #define FIFO_LENGTH 64
-#define POLL_TIME ktime_set(0, 50 * NSEC_PER_USEC)
+#define CCAT_NAPI_WEIGHT (FIFO_LENGTH / 2)
 #define CCAT_ALIGNMENT ((size_t)(128 * 1024))
+#define CCAT_DMA_SLOTS (CCAT_ALIGNMENT / sizeof(struct ccat_eth_frame))
 
-struct ccat_dma_frame_hdr {
-	__le32 reserved1;
-	__le32 rx_flags;
-#define CCAT_FRAME_RECEIVED 0x1
-	__le16 length;
-	__le16 reserved3;
-	__le32 tx_flags;
-#define CCAT_FRAME_SENT 0x1
-	__le64 timestamp;
-};
+/**
+ * TX queues: EtherCAT frames are strictly prioritized over best-effort
+ * traffic (EoE, IP, diagnosis), which is only allowed into the CCAT tx
+ * fifo while no more than CCAT_TX_BEST_EFFORT_DEPTH frames are pending.
+ */
+#define CCAT_TXQ_ETHERCAT 0
+#define CCAT_TXQ_BEST_EFFORT 1
+#define CCAT_TXQ_COUNT 2
+#define CCAT_TX_BEST_EFFORT_DEPTH 2
 
-struct ccat_eim_frame_hdr {
-	__le16 length;
-	__le16 reserved3;
-	__le32 tx_flags;
-	__le64 timestamp;
-};
+static unsigned int poll_us = 50;
+module_param(poll_us, uint, 0644);
+MODULE_PARM_DESC(poll_us, "rx/tx poll period in microseconds (default: 50)");
 
-struct ccat_eth_frame {
-	u8 placeholder[0x800];
-};
+static int poll_cpu = -1;
+module_param(poll_cpu, int, 0644);
+MODULE_PARM_DESC(poll_cpu,
+		 "CPU running the poll timer, -1 for a CPU local to the CCAT (default: -1)");
 
-struct ccat_dma_frame {
-	struct ccat_dma_frame_hdr hdr;
-	u8 data[sizeof(struct ccat_eth_frame) -
-		sizeof(struct ccat_dma_frame_hdr)];
-};
+static unsigned int link_ms = 10;
+module_param(link_ms, uint, 0644);
+MODULE_PARM_DESC(link_ms, "link state poll period in milliseconds (default: 10)");
 
-struct ccat_eim_frame {
-	struct ccat_eim_frame_hdr hdr;
-	u8 data[sizeof(struct ccat_eth_frame) -
-		sizeof(struct ccat_eim_frame_hdr)];
-};
+static unsigned int stats_ms = 1000;
+module_param(stats_ms, uint, 0644);
+MODULE_PARM_DESC(stats_ms,
+		 "MAC statistics poll period in milliseconds, packet and byte counters are at most this old (default: 1000)");
+
+/**
+ * Cycle synchronous rx: the response to an EtherCAT frame returns a
+ * predictable time after it was sent. Instead of waiting for the next
+ * poll_timer tick, napi busy polls for sync_window_ns around the expected
+ * return. The round trip time is measured with the CCAT systemtime
+ * stamped into the rx and tx frame headers, unless sync_rtt_ns is given.
+ */
+#define CCAT_SYNC_MAX_WINDOW_NS (100 * NSEC_PER_USEC)
+
+static bool sync_rx;
+module_param(sync_rx, bool, 0644);
+MODULE_PARM_DESC(sync_rx, "busy poll for EtherCAT responses (default: 0)");
+
+static unsigned int sync_rtt_ns;
+module_param(sync_rtt_ns, uint, 0644);
+MODULE_PARM_DESC(sync_rtt_ns,
+		 "expected EtherCAT round trip time in ns (default: 0 = learn)");
+
+static unsigned int sync_window_ns = 20000;
+module_param(sync_window_ns, uint, 0644);
+MODULE_PARM_DESC(sync_window_ns,
+		 "busy poll window around the expected response in ns (default: 20000)");
+
+/**
+ * Scheduled transmit: with ETF offload ("tc qdisc ... etf offload") frames
+ * carry a CLOCK_TAI launch time in skb->tstamp. CCAT has no launch time
+ * support, so they are kept in a time-ordered queue and written to the
+ * TX-FIFO txtime_lead_ns before their launch time by a pinned hrtimer.
+ * The timer fires early by its learned wakeup latency and spins the rest,
+ * at most CCAT_TXTIME_MAX_SPIN_NS. Each expiry spins at most once and
+ * sends at most CCAT_TXTIME_BATCH frames, further frames get an expiry of
+ * their own. Due frames bypass the best-effort throttle; if the ring is
+ * full, they stay first in line until poll_tx() frees a slot.
+ */
+#define CCAT_TXTIME_DEPTH 256
+#define CCAT_TXTIME_MAX_SPIN_NS (10 * NSEC_PER_USEC)
+#define CCAT_TXTIME_BATCH 4
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+#define CCAT_TXTIME_MODE HRTIMER_MODE_ABS_PINNED_SOFT
+#else
+#define CCAT_TXTIME_MODE HRTIMER_MODE_ABS_PINNED
+#endif
+
+static unsigned int txtime_lead_ns = 5000;
+module_param(txtime_lead_ns, uint, 0644);
+MODULE_PARM_DESC(txtime_lead_ns,
+		 "hand scheduled frames to CCAT this many ns before launch (default: 5000)");
+
+/**
+ * Offline self-test ("ethtool -t"): CCAT_SELFTEST_FRAMES frames of
+ * selftest_len bytes are sent through the stack on the EtherCAT queue and
+ * reflected by the software loopback, with at most CCAT_SELFTEST_WINDOW
+ * frames in flight.
+ */
+#define CCAT_SELFTEST_FRAMES 10000
+#define CCAT_SELFTEST_WINDOW 32
+#define CCAT_SELFTEST_MAGIC 0xCCA7CCA7
+
+/**
+ * struct ccat_eth_selftest_hdr - payload of a self-test frame
+ * @magic: CCAT_SELFTEST_MAGIC
+ * @seq: sequence number
+ * @timestamp: ktime_get_ns() before the frame was queued
+ */
+struct ccat_eth_selftest_hdr {
+	__be32 magic;
+	u32 seq;
+	u64 timestamp;
+} __packed;
 
-#define MAX_PAYLOAD_SIZE \
-	(sizeof(struct ccat_eth_frame) - max(sizeof(struct ccat_dma_frame_hdr), sizeof(struct ccat_eim_frame_hdr)))
+static unsigned int selftest_len = ETH_ZLEN;
+module_param(selftest_len, uint, 0644);
+MODULE_PARM_DESC(selftest_len,
+		 "frame length used by the ethtool self-test (default: 60)");
+
+/**
+ * Flight recorder: the last flight_records frames of each direction are
+ * kept with their first CCAT_FLIGHT_SNAPLEN bytes, fifo slot, host and
+ * CCAT timestamps, to be read as pcapng from
+ * <debugfs>/ccat_netdev/<device>/flight.pcapng after an incident. Each
+ * direction has a single producer, so recording is a copy into a ring
+ * without locks or atomic operations.
+ */
+#define CCAT_FLIGHT_SNAPLEN 96
+#define CCAT_FLIGHT_MIN 16
+#define CCAT_FLIGHT_MAX 65536
+
+static unsigned int flight_records = 256;
+module_param(flight_records, uint, 0444);
+MODULE_PARM_DESC(flight_records,
+		 "frames kept per direction by the flight recorder, 0 disables (default: 256)");
 
 /**
  * struct ccat_eth_register - CCAT register addresses in the PCI BAR
@@ -92,77 +208,55 @@ struct ccat_eth_register {
 	void __iomem *misc;
 };
 
-/**
- * struct ccat_dma_mem - CCAT DMA channel configuration
- * @size: number of bytes in the associated DMA memory
- * @phys: device-viewed address(physical) of the associated DMA memory
- * @dev: valid struct device pointer
- * @base: CPU-viewed address(virtual) of the associated DMA memory
- */
-struct ccat_dma_mem {
-	size_t size;
-	dma_addr_t phys;
-	struct device *dev;
-	void *base;
-};
-
-/**
- * struct ccat_dma/eim/mem
- * @next: pointer to the next frame in fifo ring buffer
- * @start: aligned CPU-viewed address(virtual) of the associated memory
- */
-struct ccat_dma {
-	struct ccat_dma_frame *next;
-	void *start;
-};
-
-struct ccat_eim {
-	struct ccat_eim_frame __iomem *next;
-	void __iomem *start;
+enum ccat_copy_dir {
+	CCAT_COPY_RX,
+	CCAT_COPY_TX,
+	CCAT_COPY_DIRS
 };
 
-struct ccat_mem {
-	struct ccat_eth_frame *next;
-	void *start;
+enum ccat_flight_dir {
+	CCAT_FLIGHT_RX,
+	CCAT_FLIGHT_TX,
+	CCAT_FLIGHT_DIRS
 };
 
 /**
- * struct ccat_eth_fifo - CCAT RX or TX fifo
- * @ops: function pointer table for dma/eim and rx/tx specific fifo functions
- * @reg: PCI register address of this fifo
- * @rx_bytes: number of bytes processed -> reported with ndo_get_stats64()
- * @rx_dropped: number of dropped frames -> reported with ndo_get_stats64()
- * @mem/dma/eim: information about the associated memory
+ * struct ccat_flight_rec - frame kept by the flight recorder
+ * @seq: ring position + 1 once the record is complete
+ * @len: length of the frame
+ * @slot: fifo slot used by the frame
+ * @hw_seq: seq of the record hw_ns belongs to, written by napi only
+ * @host_ns: CLOCK_REALTIME when the frame was received or queued
+ * @hw_ns: CCAT systemtime of the frame, for tx added once it was sent
+ * @data: the first CCAT_FLIGHT_SNAPLEN bytes of the frame
  */
-struct ccat_eth_fifo {
-	const struct ccat_eth_fifo_operations *ops;
-	const struct ccat_eth_frame *end;
-	void __iomem *reg;
-	atomic64_t bytes;
-	atomic64_t dropped;
-	struct ccat_dma_mem dma_mem;
-	union {
-		struct ccat_mem mem;
-		struct ccat_dma dma;
-		struct ccat_eim eim;
-	};
+struct ccat_flight_rec {
+	u32 seq;
+	u16 len;
+	u16 slot;
+	u32 hw_seq;
+	u64 host_ns;
+	u64 hw_ns;
+	u8 data[CCAT_FLIGHT_SNAPLEN];
 };
 
 /**
- * struct ccat_eth_fifo_operations
- * @ready: callback used to test the next frames ready bit
- * @add: callback used to add a frame to this fifo
- * @copy_to_skb: callback used to copy from rx fifos to skbs
- * @skb: callback used to queue skbs into tx fifos
+ * struct ccat_flight - flight recorder ring of one direction
+ * @rec: the records, NULL while the recorder is disabled
+ * @mask: number of records - 1, the record count is a power of two
+ * @head: free running position of the next record. Written by the
+ *        producer: napi (rx) or a tx_lock holder (tx).
  */
-struct ccat_eth_fifo_operations {
-	size_t(*ready) (struct ccat_eth_fifo *);
-	void (*add) (struct ccat_eth_fifo *);
-	union {
-		void (*copy_to_skb) (struct ccat_eth_fifo *, struct sk_buff *,
-				     size_t);
-		void (*skb) (struct ccat_eth_fifo *, struct sk_buff *);
-	} queue;
+struct ccat_flight {
+	struct ccat_flight_rec *rec;
+	u32 mask;
+	u32 head;
+};
+
+static const char *const ccat_copy_names[CCAT_COPY_COUNT] = {
+	[CCAT_COPY_MEMCPY] = "memcpy",
+	[CCAT_COPY_MOVSB] = "rep_movsb",
+	[CCAT_COPY_NOCACHE] = "nocache",
 };
 
 /**
@@ -178,25 +272,6 @@ struct ccat_mac_infoblock {
 	u32 misc;
 };
 
-/**
- * struct ccat_eth_priv - CCAT Ethernet/EtherCAT Master function (netdev)
- * @func: pointer to the parent struct ccat_function
- * @netdev: the net_device structure used by the kernel networking stack
- * @reg: register addresses in PCI config space of the Ethernet/EtherCAT Master function
- * @rx_fifo: fifo used for RX descriptors
- * @tx_fifo: fifo used for TX descriptors
- * @poll_timer: interval timer used to poll CCAT for events like link changed, rx done, tx done
- */
-struct ccat_eth_priv {
-	struct ccat_function *func;
-	struct net_device *netdev;
-	struct ccat_eth_register reg;
-	struct ccat_eth_fifo rx_fifo;
-	struct ccat_eth_fifo tx_fifo;
-	struct hrtimer poll_timer;
-	struct ccat_dma_mem dma_mem;
-};
-
 struct ccat_mac_register {
 	/** MAC error register     @+0x0 */
 	u8 frame_len_err;
@@ -223,13 +298,256 @@ struct ccat_mac_register {
 	u8 mii_connected;
 };
 
-static void ccat_eth_fifo_reset(struct ccat_eth_fifo *const fifo);
-static void fifo_set_end(struct ccat_eth_fifo *const fifo, size_t size)
+/**
+ * Housekeeping tasks executed from the napi poll, each at its own period.
+ * The fast rx/tx processing runs on every poll_timer tick.
+ */
+enum ccat_eth_task_id {
+	CCAT_TASK_LINK,
+	CCAT_TASK_STATS,
+	CCAT_TASK_COUNT
+};
+
+/**
+ * struct ccat_eth_task - schedule of one housekeeping task
+ * @period: interval between two runs in jiffies
+ * @next: jiffies of the next run
+ */
+struct ccat_eth_task {
+	unsigned long period;
+	unsigned long next;
+};
+
+/**
+ * struct ccat_pi - EtherCAT datagrams scattered into a process image
+ * @rcu: used to free a replaced table after all readers in napi are gone
+ * @image: process image, vmalloc_user()ed and mmap()ed by the cdev user
+ * @size: number of bytes in image
+ * @first: index into map of the first mapping of each frame index
+ * @map: mappings sorted by frame index, validated against size
+ */
+struct ccat_pi {
+	struct rcu_head rcu;
+	u8 *image;
+	size_t size;
+	u16 first[256 + 1];
+	struct ccat_eth_pi_map map[];
+};
+
+/**
+ * struct ccat_eth_rx_hook - kernel consumer of one EtherType
+ * @rcu: used to free the hook after all readers in napi are gone
+ * @proto: EtherType in network byte order
+ * @handler: called from napi with the frame in the rx DMA slot
+ * @ctx: passed to handler
+ */
+struct ccat_eth_rx_hook {
+	struct rcu_head rcu;
+	__be16 proto;
+	ccat_eth_rx_handler_t handler;
+	void *ctx;
+};
+
+#ifdef CCAT_ETH_URING
+/**
+ * struct ccat_eth_uring - io_uring passthrough state of the cdev
+ * @lock: protects tx_pending and rx_pending
+ * @tx_pending: SEND commands waiting for CCAT to send their last frame,
+ *              in fifo order
+ * @rx_pending: RECV command waiting for a frame, NULL if none
+ * @rx_busy: bit 0 is set while a RECV command is in flight
+ * @rx_head: free running index of the next frame in rx_buf, written by napi
+ * @rx_tail: free running index of the oldest frame in rx_buf, written by
+ *           the RECV command in flight
+ * @tx_mutex: protects tx_buf
+ * @rx_len: length of each frame in rx_buf
+ * @rx_buf: received frames waiting for RECV
+ * @tx_buf: frames of a SEND command, copied from userspace
+ */
+struct ccat_eth_uring {
+	spinlock_t lock;
+	struct list_head tx_pending;
+	struct io_uring_cmd *rx_pending;
+	unsigned long rx_busy;
+	u32 rx_head ____cacheline_aligned_in_smp;
+	u32 rx_tail ____cacheline_aligned_in_smp;
+	struct mutex tx_mutex;
+	u16 rx_len[CCAT_ETH_URING_RX_FRAMES];
+	u8 rx_buf[CCAT_ETH_URING_RX_FRAMES][ETH_FRAME_LEN];
+	u8 tx_buf[CCAT_ETH_URING_MAX_FRAMES][ETH_FRAME_LEN];
+};
+#endif
+
+/**
+ * struct ccat_eth_priv - CCAT Ethernet/EtherCAT Master function (netdev)
+ * @func: pointer to the parent struct ccat_function
+ * @netdev: the net_device structure used by the kernel networking stack
+ * @reg: register addresses in PCI config space of the Ethernet/EtherCAT Master function
+ * @rx_fifo: fifo used for RX descriptors, owned by napi
+ * @tx_fifo: fifo used for TX descriptors, SPSC between xmit and napi
+ * @tx_lock: serializes the transmit paths of all TX queues on the tx_fifo
+ * @napi: NAPI context processing rx and tx done, also used for busy polling
+ * @rx_budget: maximum number of frames received by one napi poll
+ * @tasks_pending: bitmask of ccat_eth_task_id due for execution in napi
+ * @tasks: schedule of the housekeeping tasks
+ * @poll_period: interval of the poll_timer (rx/tx fast path)
+ * @poll_timer: interval timer used to poll CCAT for events like link changed, rx done, tx done
+ * @stats_lock: protects mac, mac_rx_bytes, mac_tx_bytes and mac_jiffies
+ * @mac: copy of the CCAT MAC register updated by the stats task
+ * @mac_rx_bytes: rx byte counter at the time of mac
+ * @mac_tx_bytes: tx byte counter at the time of mac
+ * @mac_jiffies: time of mac
+ * @sync_timer: pinned timer opening the busy poll window after EtherCAT tx
+ * @sync_rtt: expected round trip time of EtherCAT frames in ns
+ * @sync_window: length of the busy poll window in ns, 0 disables sync rx
+ * @sync_learn: update sync_rtt from the frame timestamps
+ * @sync_sample: waiting for the response to sync_tx
+ * @sync_tx: tx index of the last EtherCAT frame
+ * @sync_index: datagram index of the frame at sync_tx
+ * @sync_tx_ns: CCAT tx timestamp of sync_tx, if sync_tx_seen == sync_tx
+ * @sync_tx_seen: tx index whose timestamp poll_tx() saved in sync_tx_ns
+ * @sync_until: end of the current busy poll window
+ * @txtime_queues: bitmask of TX queues with ETF offload enabled
+ * @txtime_queue: frames waiting for their launch time, ordered by tstamp
+ * @txtime_timer: pinned CLOCK_TAI timer sending the head of txtime_queue
+ * @txtime_wakeup: learned wakeup latency of txtime_timer in ns
+ * @txtime_stalled: the head of txtime_queue waits for tx ring space
+ * @templates: tx frame templates in use, template id n occupies the n-th
+ *             DMA slot counted down from the end of the tx window
+ * @template_len: frame length of each template
+ * @copy_rate: bytes/s of each copy kernel measured at probe, 0 if unsupported
+ * @debugfs: debugfs directory of this device
+ * @cdev: character device used to register a process image (DMA only)
+ * @pi: datagram scatter table, NULL while disabled
+ * @pi_lock: serializes process image changes from the cdev
+ * @pi_image: process image allocated by the cdev user
+ * @pi_size: number of bytes in pi_image
+ * @pi_seq: number of frames scattered into the process image
+ * @pi_wait: cdev readers waiting for pi_seq to change
+ * @rx_hook: EtherType consumer registered with ccat_eth_rx_register()
+ * @uring: io_uring passthrough state of the cdev, NULL until it is used
+ * @uring_rx: EtherCAT frames are kept for RECV, set by CCAT_ETH_IOC_URING_RX
+ *            under rtnl, exclusive with rx_hook
+ * @flight: flight recorder rings, indexed by enum ccat_flight_dir
+ * @flight_tx_pos: flight recorder position of the frame in each tx slot
+ */
+struct ccat_eth_priv {
+	struct ccat_function *func;
+	struct net_device *netdev;
+	struct ccat_eth_register reg;
+	struct ccat_eth_fifo rx_fifo ____cacheline_aligned_in_smp;
+	struct ccat_eth_fifo tx_fifo ____cacheline_aligned_in_smp;
+	spinlock_t tx_lock;
+	struct napi_struct napi;
+	u32 rx_budget;
+	unsigned long tasks_pending;
+	struct ccat_eth_task tasks[CCAT_TASK_COUNT];
+	ktime_t poll_period;
+	struct hrtimer poll_timer;
+	spinlock_t stats_lock;
+	struct ccat_mac_register mac;
+	u64 mac_rx_bytes;
+	u64 mac_tx_bytes;
+	unsigned long mac_jiffies;
+	struct hrtimer sync_timer;
+	u32 sync_rtt;
+	u32 sync_window;
+	bool sync_learn;
+	bool sync_sample;
+	u32 sync_tx;
+	u8 sync_index;
+	u64 sync_tx_ns;
+	u32 sync_tx_seen;
+	ktime_t sync_until;
+	unsigned long txtime_queues;
+	struct sk_buff_head txtime_queue;
+	struct hrtimer txtime_timer;
+	u32 txtime_wakeup;
+	bool txtime_stalled;
+	DECLARE_BITMAP(templates, CCAT_DMA_SLOTS);
+	u16 template_len[CCAT_DMA_SLOTS];
+	u64 copy_rate[CCAT_COPY_DIRS][CCAT_COPY_COUNT];
+	struct dentry *debugfs;
+	struct ccat_dma_mem dma_mem;
+	struct ccat_cdev *cdev;
+	struct ccat_pi __rcu *pi;
+	struct mutex pi_lock;
+	u8 *pi_image;
+	size_t pi_size;
+	atomic64_t pi_seq;
+	wait_queue_head_t pi_wait;
+	struct ccat_eth_rx_hook __rcu *rx_hook;
+#ifdef CCAT_ETH_URING
+	struct ccat_eth_uring __rcu *uring;
+	bool uring_rx;
+#endif
+	struct ccat_flight flight[CCAT_FLIGHT_DIRS];
+	u32 *flight_tx_pos;
+};
+
+/**
+ * Change the number of slots in use, rounded down to a power of two and
+ * limited to what the CCAT function supports. The fifo is reset.
+ */
+static void fifo_set_slots(struct ccat_eth_fifo *const fifo, u32 slots)
 {
-	fifo->end = fifo->mem.start + size - sizeof(struct ccat_eth_frame);
+	slots = clamp_t(u32, slots, 1, fifo->max_slots);
+	fifo->mask = rounddown_pow_of_two(slots) - 1;
 	ccat_eth_fifo_reset(fifo);
 }
 
+static inline struct ccat_eim_frame __iomem *fifo_eim_slot(const struct
+							   ccat_eth_fifo
+							   *const fifo,
+							   const u32 index)
+{
+	return fifo->eim.start + (index & fifo->mask);
+}
+
+static bool ccat_copy_supported(const enum ccat_copy_id id,
+				const enum ccat_copy_dir dir)
+{
+	switch (id) {
+	case CCAT_COPY_MEMCPY:
+		return true;
+#ifdef CONFIG_X86
+	case CCAT_COPY_MOVSB:
+		return boot_cpu_has(X86_FEATURE_ERMS);
+#endif
+#ifdef CONFIG_ARCH_HAS_UACCESS_FLUSHCACHE
+	case CCAT_COPY_NOCACHE:
+		/* keep outgoing frames from evicting the cache, rx data is
+		 * consumed by the stack right away and should stay cached */
+		return dir == CCAT_COPY_TX;
+#endif
+	default:
+		return false;
+	}
+}
+
+static __always_inline void ccat_copy(const enum ccat_copy_id id, void *dst,
+				      const void *src, size_t len)
+{
+	switch (id) {
+#ifdef CONFIG_X86
+	case CCAT_COPY_MOVSB:
+		asm volatile ("rep movsb":"+D" (dst), "+S"(src), "+c"(len)
+			      ::"memory");
+		return;
+#endif
+#ifdef CONFIG_ARCH_HAS_UACCESS_FLUSHCACHE
+	case CCAT_COPY_NOCACHE:
+		memcpy_flushcache(dst, src, len);
+		/* non-temporal stores have to reach memory before the doorbell */
+		wmb();
+		return;
+#endif
+	default:
+		memcpy(dst, src, len);
+		return;
+	}
+}
+
 static void ccat_dma_free(struct ccat_dma_mem *const dma_mem)
 {
 	if (dma_mem->base) {
@@ -247,12 +565,12 @@ static void ccat_dma_free(struct ccat_dma_mem *const dma_mem)
  * @ioaddr of the pci bar2 configspace used to calculate the address of the pci dma configuration
  * @dev which should be configured for DMA
  */
-static int ccat_dma_init(struct pci_dev *const pdev, size_t channel,
+static int ccat_dma_init(struct device *const dev, size_t channel,
 			 void __iomem * const bar2,
 			 struct ccat_eth_fifo *const fifo)
 {
 	struct ccat_dma_mem *const dma = &fifo->dma_mem;
-	dma->dev = &pdev->dev;
+	dma->dev = dev;
 	dma->size = 2 * CCAT_ALIGNMENT - 1;
 	dma->base =
 	    dma_alloc_coherent(dma->dev, dma->size, &dma->phys, GFP_KERNEL);
@@ -266,16 +584,17 @@ static int ccat_dma_init(struct pci_dev *const pdev, size_t channel,
 	const u32 phys_hi = (sizeof(phys) > sizeof(u32)) ? phys >> 32 : 0;
 	fifo->dma.start = dma->base + (phys - dma->phys);
 
-	fifo_set_end(fifo, CCAT_ALIGNMENT);
+	fifo->max_slots = CCAT_DMA_SLOTS;
+	fifo_set_slots(fifo, fifo->max_slots);
 
 	/** bit 0 enables 64 bit mode on ccat */
-	iowrite32((u32) phys | ((phys_hi) > 0), ioaddr);
-	iowrite32(phys_hi, ioaddr + 4);
+	ccat_iowrite32((u32) phys | ((phys_hi) > 0), ioaddr);
+	ccat_iowrite32(phys_hi, ioaddr + 4);
 
 	pr_info
 	    ("DMA%zu mem initialized base: 0x%p start: 0x%p phys: 0x%llx pci addr: 0x%x%08x\n size: 0x%llx bytes.\n",
 	     channel, dma->base, fifo->dma.start, (u64) dma->phys,
-	     ioread32(ioaddr + 4), ioread32(ioaddr),
+	     ccat_ioread32(ioaddr + 4), ccat_ioread32(ioaddr),
 	     (u64) dma->size);
 	return 0;
 }
@@ -288,160 +607,211 @@ static inline size_t fifo_eim_tx_ready(struct ccat_eth_fifo *const fifo)
 	static const u8 TX_FIFO_LEVEL_MASK = 0x3F;
 	void __iomem *addr = priv->reg.mac + TX_FIFO_LEVEL_OFFSET;
 
-	return !(ioread8(addr) & TX_FIFO_LEVEL_MASK);
+	return !(ccat_ioread8(addr) & TX_FIFO_LEVEL_MASK);
+}
+
+/**
+ * An empty CCAT tx fifo means all frames queued up to head were sent.
+ */
+static u32 fifo_eim_tx_sent(struct ccat_eth_fifo *const fifo)
+{
+	const u32 head = smp_load_acquire(&fifo->head);
+
+	if (fifo->tail != head && fifo_eim_tx_ready(fifo))
+		return head;
+	return fifo->tail;
 }
 
 static inline size_t fifo_eim_rx_ready(struct ccat_eth_fifo *const fifo)
 {
 	static const size_t OVERHEAD = sizeof(struct ccat_eim_frame_hdr);
-	const size_t len = ioread16(&fifo->eim.next->hdr.length);
+	const size_t len =
+	    ccat_ioread16(&fifo_eim_slot(fifo, fifo->head)->hdr.length);
 
 	return (len < OVERHEAD) ? 0 : len - OVERHEAD;
 }
 
-static void ccat_eth_fifo_inc(struct ccat_eth_fifo *fifo)
+static void fifo_eim_rx_add(struct ccat_eth_fifo *const fifo, const u32 index)
 {
-	if (++fifo->mem.next > fifo->end)
-		fifo->mem.next = fifo->mem.start;
+	struct ccat_eim_frame __iomem *frame = fifo_eim_slot(fifo, index);
+	ccat_iowrite16(0, frame);
+	wmb();
 }
 
-static void fifo_eim_rx_add(struct ccat_eth_fifo *const fifo)
+static void fifo_eim_rx_refill(struct ccat_eth_fifo *const fifo, const u32 end)
 {
-	struct ccat_eim_frame __iomem *frame = fifo->eim.next;
-	iowrite16(0, frame);
-	wmb();
+	for (; fifo->tail != end; ++fifo->tail)
+		fifo_eim_rx_add(fifo, fifo->tail);
 }
 
-static void fifo_eim_tx_add(struct ccat_eth_fifo *const fifo)
+static void fifo_eim_tx_add(struct ccat_eth_fifo *const fifo, const u32 index)
 {
 }
 
 #define memcpy_from_ccat(DEST, SRC, LEN) memcpy(DEST,(__force void*)(SRC), LEN)
 #define memcpy_to_ccat(DEST, SRC, LEN) memcpy((__force void*)(DEST),SRC, LEN)
+static u64 fifo_eim_timestamp(struct ccat_eth_fifo *const fifo,
+			      const u32 index)
+{
+	__le64 timestamp;
+
+	ccat_memcpy_fromio(&timestamp,
+			   &fifo_eim_slot(fifo, index)->hdr.timestamp,
+			   sizeof(timestamp));
+	return le64_to_cpu(timestamp);
+}
+
 static void fifo_eim_copy_to_linear_skb(struct ccat_eth_fifo *const fifo,
 					struct sk_buff *skb, const size_t len)
 {
-	memcpy_from_ccat(skb->data, fifo->eim.next->data, len);
+	memcpy_from_ccat(skb->data, fifo_eim_slot(fifo, fifo->head)->data, len);
 }
 
 static void fifo_eim_queue_skb(struct ccat_eth_fifo *const fifo,
 			       struct sk_buff *skb)
 {
-	struct ccat_eim_frame __iomem *frame = fifo->eim.next;
+	struct ccat_eim_frame __iomem *frame = fifo_eim_slot(fifo, fifo->head);
 	const u32 addr_and_length =
 	    (void __iomem *)frame - (void __iomem *)fifo->eim.start;
 
 	const __le16 length = cpu_to_le16(skb->len);
 	memcpy_to_ccat(&frame->hdr.length, &length, sizeof(length));
 	memcpy_to_ccat(frame->data, skb->data, skb->len);
-	iowrite32(addr_and_length, fifo->reg);
+	ccat_iowrite32(addr_and_length, fifo->reg);
 }
 
-static void ccat_eth_fifo_hw_reset(struct ccat_eth_fifo *const fifo)
+/**
+ * Frames leave the tx fifo in order. If the slot CCAT_TX_BEST_EFFORT_DEPTH
+ * frames behind head was already sent, less frames than that are pending.
+ */
+static inline size_t fifo_dma_tx_shallow(struct ccat_eth_fifo *const fifo)
 {
-	if (fifo->reg) {
-		iowrite32(0, fifo->reg + 0x8);
-		wmb();
-	}
+	const u32 index = READ_ONCE(fifo->head) - CCAT_TX_BEST_EFFORT_DEPTH;
+	const struct ccat_dma_frame *const frame = fifo_dma_slot(fifo, index);
+
+	return le32_to_cpu(frame->hdr.tx_flags) & CCAT_FRAME_SENT;
 }
 
-static void ccat_eth_fifo_reset(struct ccat_eth_fifo *const fifo)
+static u64 fifo_dma_timestamp(struct ccat_eth_fifo *const fifo,
+			      const u32 index)
 {
-	ccat_eth_fifo_hw_reset(fifo);
-
-	if (fifo->ops->add) {
-		fifo->mem.next = fifo->mem.start;
-		do {
-			fifo->ops->add(fifo);
-			ccat_eth_fifo_inc(fifo);
-		} while (fifo->mem.next != fifo->mem.start);
-	}
+	return le64_to_cpu(fifo_dma_slot(fifo, index)->hdr.timestamp);
 }
 
-static inline size_t fifo_dma_tx_ready(struct ccat_eth_fifo *const fifo)
+static const u8 *fifo_dma_rx_frame(struct ccat_eth_fifo *const fifo,
+				  const u32 index)
 {
-	const struct ccat_dma_frame *frame = fifo->dma.next;
-	return le32_to_cpu(frame->hdr.tx_flags) & CCAT_FRAME_SENT;
+	return fifo_dma_slot(fifo, index)->data;
 }
 
-static inline size_t fifo_dma_rx_ready(struct ccat_eth_fifo *const fifo)
+static void fifo_dma_copy_to_linear_skb(struct ccat_eth_fifo *const fifo,
+					struct sk_buff *skb, const size_t len)
 {
-	static const size_t OVERHEAD =
-	    offsetof(struct ccat_dma_frame_hdr, rx_flags);
-	const struct ccat_dma_frame *const frame = fifo->dma.next;
-
-	if (le32_to_cpu(frame->hdr.rx_flags) & CCAT_FRAME_RECEIVED) {
-		const size_t len = le16_to_cpu(frame->hdr.length);
-		return (len < OVERHEAD) ? 0 : len - OVERHEAD;
-	}
-	return 0;
+	ccat_copy(fifo->copy, skb->data, fifo_dma_slot(fifo, fifo->head)->data,
+		  len);
 }
 
-static void ccat_eth_rx_fifo_dma_add(struct ccat_eth_fifo *const fifo)
+static void fifo_dma_queue_frame(struct ccat_eth_fifo *const fifo,
+				 const void *const data, const size_t len)
 {
-	struct ccat_dma_frame *const frame = fifo->dma.next;
-	const size_t offset = (void *)frame - fifo->dma.start;
-	const u32 addr_and_length = (1 << 31) | offset;
+	struct ccat_dma_frame *const frame = fifo_dma_tx_prepare(fifo, len);
 
-	frame->hdr.rx_flags = cpu_to_le32(0);
-	iowrite32(addr_and_length, fifo->reg);
-}
+	ccat_copy(fifo->copy, frame->data, data, len);
 
-static void ccat_eth_tx_fifo_dma_add_free(struct ccat_eth_fifo *const fifo)
-{
-	/* mark frame as ready to use for tx */
-	fifo->dma.next->hdr.tx_flags = cpu_to_le32(CCAT_FRAME_SENT);
-}
+	/* napi reflects the frame, see ccat_eth_reflect() */
+	if (unlikely(fifo->loopback))
+		return;
 
-static void fifo_dma_copy_to_linear_skb(struct ccat_eth_fifo *const fifo,
-					struct sk_buff *skb, const size_t len)
-{
-	skb_copy_to_linear_data(skb, fifo->dma.next->data, len);
+	/* Queue frame into CCAT TX-FIFO */
+	ccat_iowrite32(fifo_dma_tx_doorbell(fifo, frame, len), fifo->reg);
 }
 
 static void fifo_dma_queue_skb(struct ccat_eth_fifo *const fifo,
 			       struct sk_buff *skb)
 {
-	struct ccat_dma_frame *frame = fifo->dma.next;
-	u32 addr_and_length;
-
-	frame->hdr.tx_flags = cpu_to_le32(0);
-	frame->hdr.length = cpu_to_le16(skb->len);
-
-	memcpy(frame->data, skb->data, skb->len);
-
-	/* Queue frame into CCAT TX-FIFO, CCAT ignores the first 8 bytes of the tx descriptor */
-	addr_and_length = offsetof(struct ccat_dma_frame_hdr, length);
-	addr_and_length += ((void *)frame - fifo->dma.start);
-	addr_and_length +=
-	    ((skb->len + sizeof(struct ccat_dma_frame_hdr)) / 8) << 24;
-	iowrite32(addr_and_length, fifo->reg);
+	fifo_dma_queue_frame(fifo, skb->data, skb->len);
 }
 
 static const struct ccat_eth_fifo_operations dma_rx_fifo_ops = {
 	.add = ccat_eth_rx_fifo_dma_add,
+	.refill = fifo_dma_rx_refill,
+	.frame = fifo_dma_rx_frame,
 	.ready = fifo_dma_rx_ready,
+	.timestamp = fifo_dma_timestamp,
 	.queue.copy_to_skb = fifo_dma_copy_to_linear_skb,
 };
 
 static const struct ccat_eth_fifo_operations dma_tx_fifo_ops = {
 	.add = ccat_eth_tx_fifo_dma_add_free,
-	.ready = fifo_dma_tx_ready,
+	.sent = fifo_dma_tx_sent,
+	.shallow = fifo_dma_tx_shallow,
+	.timestamp = fifo_dma_timestamp,
 	.queue.skb = fifo_dma_queue_skb,
 };
 
 static const struct ccat_eth_fifo_operations eim_rx_fifo_ops = {
 	.add = fifo_eim_rx_add,
+	.refill = fifo_eim_rx_refill,
 	.queue.copy_to_skb = fifo_eim_copy_to_linear_skb,
 	.ready = fifo_eim_rx_ready,
+	.timestamp = fifo_eim_timestamp,
 };
 
 static const struct ccat_eth_fifo_operations eim_tx_fifo_ops = {
 	.add = fifo_eim_tx_add,
 	.queue.skb = fifo_eim_queue_skb,
-	.ready = fifo_eim_tx_ready,
+	.sent = fifo_eim_tx_sent,
+	.shallow = fifo_eim_tx_ready,
+	.timestamp = fifo_eim_timestamp,
 };
 
+static void ccat_flight_free(struct ccat_eth_priv *const priv)
+{
+	int dir;
+
+	for (dir = 0; dir < CCAT_FLIGHT_DIRS; ++dir) {
+		vfree(priv->flight[dir].rec);
+		priv->flight[dir].rec = NULL;
+	}
+	kfree(priv->flight_tx_pos);
+	priv->flight_tx_pos = NULL;
+}
+
+/**
+ * Allocate the flight recorder rings, once the fifos are initialized.
+ * The recorder is optional, without memory it stays disabled.
+ */
+static void ccat_flight_init(struct ccat_eth_priv *const priv)
+{
+	const int node = dev_to_node(priv->func->ccat->dev);
+	u32 records;
+	int dir;
+
+	if (!flight_records)
+		return;
+	records = rounddown_pow_of_two(clamp_t(u32, flight_records,
+					       CCAT_FLIGHT_MIN,
+					       CCAT_FLIGHT_MAX));
+
+	priv->flight_tx_pos =
+	    kcalloc_node(priv->tx_fifo.max_slots, sizeof(u32), GFP_KERNEL,
+			 node);
+	if (!priv->flight_tx_pos)
+		goto fail;
+	for (dir = 0; dir < CCAT_FLIGHT_DIRS; ++dir) {
+		priv->flight[dir].rec =
+		    vzalloc_node(records * sizeof(struct ccat_flight_rec),
+				 node);
+		if (!priv->flight[dir].rec)
+			goto fail;
+		priv->flight[dir].mask = records - 1;
+	}
+	return;
+fail:
+	pr_warn("%s(): no memory, flight recorder disabled.\n", __FUNCTION__);
+	ccat_flight_free(priv);
+}
+
 static void ccat_eth_priv_free(struct ccat_eth_priv *priv)
 {
 	/* reset hw fifo's */
@@ -451,11 +821,12 @@ static void ccat_eth_priv_free(struct ccat_eth_priv *priv)
 	/* release dma */
 	ccat_dma_free(&priv->rx_fifo.dma_mem);
 	ccat_dma_free(&priv->tx_fifo.dma_mem);
+	ccat_flight_free(priv);
 }
 
 static int ccat_hw_disable_mac_filter(struct ccat_eth_priv *priv)
 {
-	iowrite8(0, priv->reg.mii + 0x8 + 6);
+	ccat_iowrite8(0, priv->reg.mii + 0x8 + 6);
 	wmb();
 	return 0;
 }
@@ -465,21 +836,21 @@ static int ccat_hw_disable_mac_filter(struct ccat_eth_priv *priv)
  */
 static int ccat_eth_priv_init_dma(struct ccat_eth_priv *priv)
 {
-	struct pci_dev *const pdev = priv->func->ccat->pdev;
+	struct device *const dev = priv->func->ccat->dev;
 	void __iomem *const bar_2 = priv->func->ccat->bar_2;
 	const u8 rx_chan = priv->func->info.rx_dma_chan;
 	const u8 tx_chan = priv->func->info.tx_dma_chan;
 	int status = 0;
 
 	priv->rx_fifo.ops = &dma_rx_fifo_ops;
-	status = ccat_dma_init(pdev, rx_chan, bar_2, &priv->rx_fifo);
+	status = ccat_dma_init(dev, rx_chan, bar_2, &priv->rx_fifo);
 	if (status) {
 		pr_info("init RX DMA memory failed.\n");
 		return status;
 	}
 
 	priv->tx_fifo.ops = &dma_tx_fifo_ops;
-	status = ccat_dma_init(pdev, tx_chan, bar_2, &priv->tx_fifo);
+	status = ccat_dma_init(dev, tx_chan, bar_2, &priv->tx_fifo);
 	if (status) {
 		pr_info("init TX DMA memory failed.\n");
 		ccat_dma_free(&priv->rx_fifo.dma_mem);
@@ -493,11 +864,16 @@ static int ccat_eth_priv_init_eim(struct ccat_eth_priv *priv)
 {
 	priv->rx_fifo.eim.start = priv->reg.rx_mem;
 	priv->rx_fifo.ops = &eim_rx_fifo_ops;
-	fifo_set_end(&priv->rx_fifo, sizeof(struct ccat_eth_frame));
+	/* the eim rx path handles exactly one frame at rx_mem */
+	priv->rx_fifo.max_slots = 1;
+	fifo_set_slots(&priv->rx_fifo, priv->rx_fifo.max_slots);
 
 	priv->tx_fifo.eim.start = priv->reg.tx_mem;
 	priv->tx_fifo.ops = &eim_tx_fifo_ops;
-	fifo_set_end(&priv->tx_fifo, priv->func->info.tx_size);
+	priv->tx_fifo.max_slots =
+	    max_t(u32, priv->func->info.tx_size / sizeof(struct ccat_eth_frame),
+		  1);
+	fifo_set_slots(&priv->tx_fifo, priv->tx_fifo.max_slots);
 
 	return ccat_hw_disable_mac_filter(priv);
 }
@@ -514,18 +890,18 @@ static void ccat_eth_priv_init_reg(struct ccat_eth_priv *const priv)
 	void __iomem *const func_base = func->ccat->bar_0 + func->info.addr;
 
 	/* struct ccat_eth_fifo contains a union of ccat_dma, ccat_eim and ccat_mem
-	 * the members next and start have to overlay the exact same memory,
-	 * to support 'polymorphic' usage of them */
-	BUILD_BUG_ON(offsetof(struct ccat_dma, next) !=
-		     offsetof(struct ccat_mem, next));
+	 * the member start has to overlay the exact same memory, to support
+	 * 'polymorphic' usage of it. All slots have the same size. */
 	BUILD_BUG_ON(offsetof(struct ccat_dma, start) !=
 		     offsetof(struct ccat_mem, start));
-	BUILD_BUG_ON(offsetof(struct ccat_dma, next) !=
-		     offsetof(struct ccat_eim, next));
 	BUILD_BUG_ON(offsetof(struct ccat_dma, start) !=
 		     offsetof(struct ccat_eim, start));
+	BUILD_BUG_ON(sizeof(struct ccat_dma_frame) !=
+		     sizeof(struct ccat_eth_frame));
+	BUILD_BUG_ON(sizeof(struct ccat_eim_frame) !=
+		     sizeof(struct ccat_eth_frame));
 
-	memcpy_fromio(&offsets, func_base, sizeof(offsets));
+	ccat_memcpy_fromio(&offsets, func_base, sizeof(offsets));
 	reg->mii = func_base + offsets.mii;
 	priv->tx_fifo.reg = func_base + offsets.tx_fifo;
 	priv->rx_fifo.reg = func_base + offsets.tx_fifo + 0x10;
@@ -535,314 +911,3121 @@ static void ccat_eth_priv_init_reg(struct ccat_eth_priv *const priv)
 	reg->misc = func_base + offsets.misc;
 }
 
-static netdev_tx_t ccat_eth_start_xmit(struct sk_buff *skb,
-				       struct net_device *dev)
+/**
+ * EtherCAT frame layout: ethernet header, 2 byte EtherCAT header and the
+ * datagrams, each with a 10 byte header, data and a 2 byte working counter
+ */
+#define CCAT_ECAT_HDR_LEN 2
+#define CCAT_DGRAM_HDR_LEN 10
+#define CCAT_DGRAM_LEN_OFFSET 6
+#define CCAT_DGRAM_LEN_MASK 0x7ff
+#define CCAT_DGRAM_WKC_LEN 2
+
+/**
+ * Index of the first datagram, which identifies an EtherCAT frame
+ * @return -1 if this is no EtherCAT frame
+ */
+static inline int ccat_ecat_index(const u8 *const frame, const size_t len)
 {
-	struct ccat_eth_priv *const priv = netdev_priv(dev);
-	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	const struct ethhdr *const eth = (const struct ethhdr *)frame;
 
-	if (skb_is_nonlinear(skb)) {
-		pr_warn("Non linear skb not supported -> drop frame.\n");
-		atomic64_inc(&fifo->dropped);
-		dev_kfree_skb_any(skb);
-		return NETDEV_TX_OK;
-	}
+	if (len < ETH_HLEN + CCAT_ECAT_HDR_LEN + CCAT_DGRAM_HDR_LEN
+	    || eth->h_proto != htons(ETH_P_ETHERCAT))
+		return -1;
+	return frame[ETH_HLEN + CCAT_ECAT_HDR_LEN + 1];
+}
 
-	if (skb->len > MAX_PAYLOAD_SIZE) {
-		pr_warn("skb.len %llu exceeds dma buffer %llu -> drop frame.\n",
-			(u64) skb->len, (u64) MAX_PAYLOAD_SIZE);
-		atomic64_inc(&fifo->dropped);
-		dev_kfree_skb_any(skb);
-		return NETDEV_TX_OK;
-	}
+/**
+ * Wait for the response to the EtherCAT frame at tx index to sample
+ * sync_rtt. Called with tx_lock held, after index was published, so
+ * concurrent senders can't mix up the sample.
+ */
+static void ccat_eth_sync_sample(struct ccat_eth_priv *const priv,
+				 const u32 index, const u8 *const frame,
+				 const size_t len)
+{
+	const int ecat_index = ccat_ecat_index(frame, len);
 
-	if (!fifo->ops->ready(fifo)) {
-		netdev_err(dev, "BUG! Tx Ring full when queue awake!\n");
-		netif_stop_queue(priv->netdev);
-		return NETDEV_TX_BUSY;
+	if (priv->sync_learn && ecat_index >= 0) {
+		WRITE_ONCE(priv->sync_sample, false);
+		WRITE_ONCE(priv->sync_tx, index);
+		WRITE_ONCE(priv->sync_index, ecat_index);
+		WRITE_ONCE(priv->sync_tx_seen, index - 1);
+		/* pairs with smp_load_acquire() in poll_rx() and poll_tx() */
+		smp_store_release(&priv->sync_sample, true);
 	}
+}
 
-	/* prepare frame in DMA memory */
-	fifo->ops->queue.skb(fifo, skb);
+/**
+ * Open the busy poll window, when the response to the last EtherCAT frame
+ * is expected.
+ */
+static void ccat_eth_sync_arm(struct ccat_eth_priv *const priv)
+{
+	const u32 rtt = READ_ONCE(priv->sync_rtt);
+	const u32 lead = priv->sync_window / 2;
 
-	/* update stats */
-	atomic64_add(skb->len, &fifo->bytes);
+	hrtimer_start(&priv->sync_timer, ns_to_ktime(rtt > lead ? rtt - lead : 0),
+		      HRTIMER_MODE_REL_PINNED);
+}
 
-	dev_kfree_skb_any(skb);
+static enum hrtimer_restart sync_timer_callback(struct hrtimer *timer)
+{
+	struct ccat_eth_priv *const priv =
+	    container_of(timer, struct ccat_eth_priv, sync_timer);
 
-	ccat_eth_fifo_inc(fifo);
-	/* stop queue if tx ring is full */
-	if (!fifo->ops->ready(fifo)) {
-		netif_stop_queue(priv->netdev);
-	}
-	return NETDEV_TX_OK;
+	WRITE_ONCE(priv->sync_until, ktime_add_ns(ktime_get(), priv->sync_window));
+	napi_schedule(&priv->napi);
+	return HRTIMER_NORESTART;
 }
 
 /**
- * Function to transmit a raw buffer to the network (f.e. frameForwardEthernetFrames)
- * @dev a valid net_device
- * @data pointer to your raw buffer
- * @len number of bytes in the raw buffer to transmit
+ * Save the CCAT tx timestamp of sync_tx, if it is in the range [tail, end)
+ * poll_tx() is about to hand back to the producer. Afterwards the slot
+ * might be reused.
  */
-static void ccat_eth_xmit_raw(struct net_device *dev, const char *const data,
-			      size_t len)
+static __always_inline void ccat_eth_sync_tx_done(struct ccat_eth_priv *const
+						   priv, const u32 tail,
+						   const u32 end,
+						   const struct ccat_eth_fifo_operations *const tx_ops)
 {
-	struct sk_buff *skb = dev_alloc_skb(len);
+	u32 index;
 
-	skb->dev = dev;
-	skb_copy_to_linear_data(skb, data, len);
-	skb_put(skb, len);
-	ccat_eth_start_xmit(skb, dev);
+	if (!smp_load_acquire(&priv->sync_sample))
+		return;
+	index = READ_ONCE(priv->sync_tx);
+	if (index - tail < end - tail) {
+		priv->sync_tx_ns = tx_ops->timestamp(&priv->tx_fifo, index);
+		smp_store_release(&priv->sync_tx_seen, index);
+	}
 }
 
-static void ccat_eth_receive(struct ccat_eth_priv *const priv, const size_t len)
+/**
+ * Update the expected round trip time with the CCAT systemtime difference
+ * between the last EtherCAT frame sent and its response, the received
+ * EtherCAT frame with the same datagram index. Called by poll_rx() for the
+ * frame at head of the rx fifo, while a sample is pending. frame is NULL
+ * in EIM mode.
+ */
+static __always_inline void ccat_eth_sync_learn(struct ccat_eth_priv *const
+						 priv, const u8 *frame,
+						 const size_t len,
+						 const struct ccat_eth_fifo_operations *const rx_ops,
+						 const struct ccat_eth_fifo_operations *const tx_ops)
 {
-	struct sk_buff *const skb = dev_alloc_skb(len + NET_IP_ALIGN);
-	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
-	struct net_device *const dev = priv->netdev;
+	struct ccat_eth_fifo *const rx_fifo = &priv->rx_fifo;
+	struct ccat_eth_fifo *const tx_fifo = &priv->tx_fifo;
+	const u32 tx_index = READ_ONCE(priv->sync_tx);
+	u8 hdr[ETH_HLEN + CCAT_ECAT_HDR_LEN + CCAT_DGRAM_HDR_LEN];
+	u64 tx_ns;
+	s64 rtt;
 
-	if (!skb) {
-		pr_info("%s() out of memory :-(\n", __FUNCTION__);
-		atomic64_inc(&fifo->dropped);
+	if (!frame && len >= sizeof(hdr)) {
+		ccat_memcpy_fromio(hdr, fifo_eim_slot(rx_fifo, rx_fifo->head)->data,
+				   sizeof(hdr));
+		frame = hdr;
+	}
+	if (!frame || ccat_ecat_index(frame, len) != READ_ONCE(priv->sync_index))
 		return;
+
+	if (smp_load_acquire(&priv->sync_tx_seen) == tx_index) {
+		tx_ns = priv->sync_tx_ns;
+	} else {
+		/* napi owns tail, a slot not reclaimed yet can't be reused */
+		if ((s32) (tx_index - tx_fifo->tail) < 0
+		    || (s32) (tx_ops->sent(tx_fifo) - tx_index) <= 0)
+			return;
+		tx_ns = tx_ops->timestamp(tx_fifo, tx_index);
 	}
-	skb->dev = dev;
-	skb_reserve(skb, NET_IP_ALIGN);
-	fifo->ops->queue.copy_to_skb(fifo, skb, len);
-	skb_put(skb, len);
-	skb->protocol = eth_type_trans(skb, dev);
-	skb->ip_summed = CHECKSUM_UNNECESSARY;
-	atomic64_add(len, &fifo->bytes);
-	netif_rx(skb);
+
+	/* rejects a frame with the same index received before the request */
+	rtt = rx_ops->timestamp(rx_fifo, rx_fifo->head) - tx_ns;
+	if (rtt <= 0 || rtt > NSEC_PER_MSEC)
+		return;
+	WRITE_ONCE(priv->sync_sample, false);
+
+	/* moving average over 8 samples, seeded by the first one */
+	if (!priv->sync_rtt)
+		WRITE_ONCE(priv->sync_rtt, rtt);
+	else
+		WRITE_ONCE(priv->sync_rtt,
+			   priv->sync_rtt + ((s32) rtt - (s32) priv->sync_rtt) / 8);
 }
 
-static void ccat_eth_link_down(struct net_device *const dev)
+/**
+ * Copy a frame into the flight recorder, only called by the producer of
+ * the ring. The record is invalidated, before it is overwritten, so a
+ * concurrent reader can detect the change.
+ * @return ring position of the record
+ */
+static inline u32 ccat_flight_record(struct ccat_flight *const fl,
+				     const void *const data, const size_t len,
+				     const u32 slot)
 {
-	netif_stop_queue(dev);
-	netif_carrier_off(dev);
-	netdev_info(dev, "NIC Link is Down\n");
+	const u32 pos = fl->head;
+	struct ccat_flight_rec *const rec = &fl->rec[pos & fl->mask];
+
+	WRITE_ONCE(rec->seq, pos);
+	smp_wmb();
+	rec->host_ns = ktime_get_real_ns();
+	rec->len = len;
+	rec->slot = slot;
+	memcpy(rec->data, data, min_t(size_t, len, CCAT_FLIGHT_SNAPLEN));
+	smp_store_release(&rec->seq, pos + 1);
+	smp_store_release(&fl->head, pos + 1);
+	return pos;
+}
+
+/**
+ * Attach a CCAT timestamp to the record at pos, called from napi only.
+ * hw_seq is a seqcount of its own, since tx timestamps are added while
+ * the producer might already reuse the record.
+ */
+static inline void ccat_flight_hw(struct ccat_flight *const fl, const u32 pos,
+				  const u64 hw_ns)
+{
+	struct ccat_flight_rec *const rec = &fl->rec[pos & fl->mask];
+
+	WRITE_ONCE(rec->hw_seq, pos);
+	smp_wmb();
+	WRITE_ONCE(rec->hw_ns, hw_ns);
+	smp_store_release(&rec->hw_seq, pos + 1);
+}
+
+/**
+ * Record the frame at head of the rx fifo
+ */
+static __always_inline void ccat_flight_rx(struct ccat_eth_priv *const priv,
+					    const void *const data,
+					    const size_t len,
+					    const struct ccat_eth_fifo_operations *const rx_ops)
+{
+	struct ccat_flight *const fl = &priv->flight[CCAT_FLIGHT_RX];
+	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
+	u32 pos;
+
+	if (!fl->rec)
+		return;
+	pos = ccat_flight_record(fl, data, len, fifo->head & fifo->mask);
+	ccat_flight_hw(fl, pos, rx_ops->timestamp(fifo, fifo->head));
+}
+
+/**
+ * Record a frame queued at index of the tx fifo, before index is published
+ * to napi. Caller holds tx_lock.
+ */
+static inline void ccat_flight_tx(struct ccat_eth_priv *const priv,
+				  const void *const data, const size_t len,
+				  const u32 index)
+{
+	struct ccat_flight *const fl = &priv->flight[CCAT_FLIGHT_TX];
+	const u32 slot = index & priv->tx_fifo.mask;
+
+	if (fl->rec)
+		priv->flight_tx_pos[slot] =
+		    ccat_flight_record(fl, data, len, slot);
+}
+
+/**
+ * Attach the CCAT timestamps to the records of the tx frames sent from
+ * tail up to end. Must run before tail is moved to end, afterwards the
+ * producer may reuse the slots and their flight_tx_pos.
+ */
+static __always_inline void ccat_flight_tx_done(struct ccat_eth_priv *const
+						 priv, const u32 tail,
+						 const u32 end,
+						 const struct ccat_eth_fifo_operations *const tx_ops)
+{
+	struct ccat_flight *const fl = &priv->flight[CCAT_FLIGHT_TX];
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	u32 i;
+
+	if (!fl->rec)
+		return;
+	for (i = tail; i != end; ++i)
+		ccat_flight_hw(fl, priv->flight_tx_pos[i & fifo->mask],
+			       tx_ops->timestamp(fifo, i));
+}
+
+/**
+ * Called after each transmit, while the fifo state is still hot in the
+ * cache. Received frames and tx completions are handed to napi right away,
+ * instead of waiting for the next poll_timer tick. Not every caller runs
+ * with bottom halves disabled, e.g. a direct ndo_start_xmit() call from
+ * process context. Those get them disabled here, so napi runs on this CPU
+ * as soon as they are enabled again, instead of leaving NET_RX_SOFTIRQ
+ * pending until the next interrupt. napi remains the only consumer of
+ * both fifos.
+ */
+static __always_inline void ccat_eth_xmit_reap(struct ccat_eth_priv *const
+						priv,
+						const struct ccat_eth_fifo_operations *const rx_ops)
+{
+	struct ccat_eth_fifo *const rx_fifo = &priv->rx_fifo;
+	struct net_device *const dev = priv->netdev;
+
+	if (rx_ops->ready(rx_fifo)
+	    || unlikely(priv->tx_fifo.loopback)
+	    || __netif_subqueue_stopped(dev, CCAT_TXQ_ETHERCAT)
+	    || __netif_subqueue_stopped(dev, CCAT_TXQ_BEST_EFFORT)) {
+		/* e.g. the txtime timer, napi runs at softirq or irq exit */
+		if (in_softirq() || irqs_disabled()) {
+			napi_schedule(&priv->napi);
+		} else {
+			local_bh_disable();
+			napi_schedule(&priv->napi);
+			local_bh_enable();
+		}
+	}
+}
+
+/**
+ * The fast paths are instantiated once per transport: the fifo operations
+ * are passed as pointers to the constant ops tables, which the compiler
+ * resolves into direct (and mostly inlined) calls. Selecting the instance
+ * costs one well predicted branch per xmit or napi poll, instead of an
+ * indirect call per fifo access.
+ */
+static inline bool ccat_eth_is_dma(const struct ccat_eth_priv *const priv)
+{
+	return priv->rx_fifo.ops == &dma_rx_fifo_ops;
+}
+
+/**
+ * Stop all queues if tx ring is full, best-effort if it is deep. Called
+ * with tx_lock held, after frames were queued.
+ */
+static __always_inline void ccat_eth_tx_throttle(struct ccat_eth_priv *const
+						  priv,
+						  const struct ccat_eth_fifo_operations *const tx_ops)
+{
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	struct net_device *const dev = priv->netdev;
+
+	if (!ccat_eth_tx_space(fifo)) {
+		netif_tx_stop_all_queues(dev);
+		/* pairs with smp_mb() in poll_tx(), which might have reclaimed
+		 * slots before it could see the stopped queues */
+		smp_mb();
+		if (ccat_eth_tx_space(fifo))
+			netif_wake_subqueue(dev, CCAT_TXQ_ETHERCAT);
+	} else if (!tx_ops->shallow(fifo)) {
+		netif_stop_subqueue(dev, CCAT_TXQ_BEST_EFFORT);
+	}
+}
+
+/**
+ * Write a frame to the TX-FIFO and publish it. Called with tx_lock held,
+ * after the caller made sure there is space.
+ */
+static __always_inline void ccat_eth_tx_skb(struct ccat_eth_priv *const priv,
+					    struct sk_buff *const skb,
+					    const struct ccat_eth_fifo_operations *const tx_ops)
+{
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	u32 index;
+
+	/* prepare frame in DMA memory */
+	tx_ops->queue.skb(fifo, skb);
+	ccat_flight_tx(priv, skb->data, skb->len, fifo->head);
+
+	/* update stats */
+	atomic64_add(skb->len, &fifo->bytes);
+
+	/* publish the frame to poll_tx() */
+	index = fifo->head;
+	smp_store_release(&fifo->head, index + 1);
+
+	if (skb_get_queue_mapping(skb) == CCAT_TXQ_ETHERCAT && priv->sync_window)
+		ccat_eth_sync_sample(priv, index, skb->data, skb->len);
+}
+
+static __always_inline netdev_tx_t __ccat_eth_start_xmit(struct sk_buff *skb,
+							 struct net_device *dev,
+							 const struct ccat_eth_fifo_operations *const
+							 rx_ops,
+							 const struct ccat_eth_fifo_operations *const
+							 tx_ops)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	const u16 queue = skb_get_queue_mapping(skb);
+	unsigned long flags;
+
+	if (skb_is_nonlinear(skb)) {
+		pr_warn("Non linear skb not supported -> drop frame.\n");
+		atomic64_inc(&fifo->dropped);
+		dev_kfree_skb_any(skb);
+		return NETDEV_TX_OK;
+	}
+
+	if (skb->len > MAX_PAYLOAD_SIZE) {
+		pr_warn("skb.len %llu exceeds dma buffer %llu -> drop frame.\n",
+			(u64) skb->len, (u64) MAX_PAYLOAD_SIZE);
+		atomic64_inc(&fifo->dropped);
+		dev_kfree_skb_any(skb);
+		return NETDEV_TX_OK;
+	}
+
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	if (!ccat_eth_tx_space(fifo)) {
+		spin_unlock_irqrestore(&priv->tx_lock, flags);
+		netdev_err(dev, "BUG! Tx Ring full when queue awake!\n");
+		netif_tx_stop_all_queues(dev);
+		ccat_eth_xmit_reap(priv, rx_ops);
+		return NETDEV_TX_BUSY;
+	}
+
+	/* EtherCAT frames got ahead of us, hold back best-effort traffic */
+	if (queue == CCAT_TXQ_BEST_EFFORT && !tx_ops->shallow(fifo)) {
+		netif_stop_subqueue(dev, CCAT_TXQ_BEST_EFFORT);
+		spin_unlock_irqrestore(&priv->tx_lock, flags);
+		ccat_eth_xmit_reap(priv, rx_ops);
+		return NETDEV_TX_BUSY;
+	}
+
+	ccat_eth_tx_skb(priv, skb, tx_ops);
+	ccat_eth_tx_throttle(priv, tx_ops);
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+
+	if (queue == CCAT_TXQ_ETHERCAT && priv->sync_window)
+		ccat_eth_sync_arm(priv);
+	ccat_eth_xmit_reap(priv, rx_ops);
+
+	dev_kfree_skb_any(skb);
+	return NETDEV_TX_OK;
+}
+
+static netdev_tx_t ccat_eth_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	if (ccat_eth_is_dma(netdev_priv(dev)))
+		return __ccat_eth_start_xmit(skb, dev, &dma_rx_fifo_ops,
+					     &dma_tx_fifo_ops);
+	return __ccat_eth_start_xmit(skb, dev, &eim_rx_fifo_ops,
+				     &eim_tx_fifo_ops);
+}
+
+/**
+ * Time at which a scheduled frame has to be written to the TX-FIFO
+ */
+static inline ktime_t ccat_eth_txtime_due(const struct sk_buff *const skb)
+{
+	return ktime_sub_ns(skb->tstamp, READ_ONCE(txtime_lead_ns));
+}
+
+/**
+ * Insert a frame into txtime_queue by launch time. Called with the queue
+ * lock held.
+ * @return true if the frame became the new head
+ */
+static bool __ccat_eth_txtime_insert(struct sk_buff_head *const queue,
+				     struct sk_buff *skb)
+{
+	struct sk_buff *prev;
+
+	/* frames mostly arrive in launch time order, search from the tail */
+	skb_queue_reverse_walk(queue, prev) {
+		if (ktime_compare(prev->tstamp, skb->tstamp) <= 0)
+			break;
+	}
+	if (prev == (struct sk_buff *)queue) {
+		__skb_queue_head(queue, skb);
+		return true;
+	}
+	__skb_queue_after(queue, prev, skb);
+	return false;
+}
+
+/**
+ * Insert a frame with launch time into txtime_queue and arm the timer, if
+ * it became the new head.
+ * @return false if the frame is due already and should be sent right away
+ */
+static bool ccat_eth_txtime_enqueue(struct ccat_eth_priv *const priv,
+				    struct sk_buff *skb)
+{
+	struct sk_buff_head *const queue = &priv->txtime_queue;
+	const ktime_t due = ccat_eth_txtime_due(skb);
+	unsigned long flags;
+
+	if (ktime_compare(due, ktime_get_clocktai()) <= 0)
+		return false;
+
+	spin_lock_irqsave(&queue->lock, flags);
+	if (skb_queue_len(queue) >= CCAT_TXTIME_DEPTH) {
+		spin_unlock_irqrestore(&queue->lock, flags);
+		atomic64_inc(&priv->tx_fifo.dropped);
+		dev_kfree_skb_any(skb);
+		return true;
+	}
+
+	if (__ccat_eth_txtime_insert(queue, skb))
+		hrtimer_start(&priv->txtime_timer,
+			      ktime_sub_ns(due, priv->txtime_wakeup),
+			      CCAT_TXTIME_MODE);
+	spin_unlock_irqrestore(&queue->lock, flags);
+	return true;
+}
+
+/**
+ * Send a due frame from txtime_timer. Unlike ndo_start_xmit() this ignores
+ * the best-effort throttle, the launch time already decided the order.
+ * @return false if the tx ring is full, the frame was not consumed
+ */
+static __always_inline bool __ccat_eth_txtime_xmit(struct ccat_eth_priv *const
+						   priv, struct sk_buff *skb,
+						   const struct ccat_eth_fifo_operations *const
+						   rx_ops,
+						   const struct ccat_eth_fifo_operations *const
+						   tx_ops)
+{
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	unsigned long flags;
+
+	if (skb_is_nonlinear(skb) || skb->len > MAX_PAYLOAD_SIZE) {
+		atomic64_inc(&fifo->dropped);
+		dev_kfree_skb_any(skb);
+		return true;
+	}
+
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	if (!ccat_eth_tx_space(fifo)) {
+		spin_unlock_irqrestore(&priv->tx_lock, flags);
+		return false;
+	}
+	ccat_eth_tx_skb(priv, skb, tx_ops);
+	ccat_eth_tx_throttle(priv, tx_ops);
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+
+	if (skb_get_queue_mapping(skb) == CCAT_TXQ_ETHERCAT && priv->sync_window)
+		ccat_eth_sync_arm(priv);
+	ccat_eth_xmit_reap(priv, rx_ops);
+
+	dev_kfree_skb_any(skb);
+	return true;
+}
+
+static bool ccat_eth_txtime_xmit(struct ccat_eth_priv *const priv,
+				 struct sk_buff *skb)
+{
+	if (ccat_eth_is_dma(priv))
+		return __ccat_eth_txtime_xmit(priv, skb, &dma_rx_fifo_ops,
+					      &dma_tx_fifo_ops);
+	return __ccat_eth_txtime_xmit(priv, skb, &eim_rx_fifo_ops,
+				      &eim_tx_fifo_ops);
+}
+
+/**
+ * The tx ring is full, keep the frame first in line and let poll_tx()
+ * restart the timer once it freed a slot.
+ * @return true if the slot was freed meanwhile, so the caller retries
+ */
+static bool ccat_eth_txtime_stall(struct ccat_eth_priv *const priv,
+				  struct sk_buff *skb)
+{
+	struct sk_buff_head *const queue = &priv->txtime_queue;
+	unsigned long flags;
+
+	spin_lock_irqsave(&queue->lock, flags);
+	__ccat_eth_txtime_insert(queue, skb);
+	spin_unlock_irqrestore(&queue->lock, flags);
+
+	WRITE_ONCE(priv->txtime_stalled, true);
+	/* pairs with smp_mb() in poll_tx() */
+	smp_mb();
+	if (!ccat_eth_tx_space(&priv->tx_fifo))
+		return false;
+	WRITE_ONCE(priv->txtime_stalled, false);
+	return true;
+}
+
+static enum hrtimer_restart txtime_timer_callback(struct hrtimer *timer)
+{
+	struct ccat_eth_priv *const priv =
+	    container_of(timer, struct ccat_eth_priv, txtime_timer);
+	struct sk_buff_head *const queue = &priv->txtime_queue;
+	const s64 wakeup =
+	    ktime_to_ns(ktime_sub(ktime_get_clocktai(),
+				  hrtimer_get_expires(timer)));
+	unsigned int budget = CCAT_TXTIME_BATCH;
+	bool spun = false;
+	struct sk_buff *skb;
+	unsigned long flags;
+	ktime_t due;
+	s64 wait;
+
+	/* moving average over 8 samples, seeded by the first one */
+	if (wakeup > 0 && wakeup < CCAT_TXTIME_MAX_SPIN_NS) {
+		if (!priv->txtime_wakeup)
+			priv->txtime_wakeup = wakeup;
+		else
+			priv->txtime_wakeup +=
+			    ((s32) wakeup - (s32) priv->txtime_wakeup) / 8;
+	}
+
+	for (;;) {
+		spin_lock_irqsave(&queue->lock, flags);
+		skb = skb_peek(queue);
+		if (!skb) {
+			spin_unlock_irqrestore(&queue->lock, flags);
+			return HRTIMER_NORESTART;
+		}
+		due = ccat_eth_txtime_due(skb);
+		wait = ktime_to_ns(ktime_sub(due, ktime_get_clocktai()));
+		/* after the first spin, only frames already due are sent */
+		if (!budget || wait > (spun ? 0 : CCAT_TXTIME_MAX_SPIN_NS)) {
+			/* a new head already restarted us from xmit */
+			if (hrtimer_is_queued(timer)) {
+				spin_unlock_irqrestore(&queue->lock, flags);
+				return HRTIMER_NORESTART;
+			}
+			hrtimer_set_expires(timer,
+					    ktime_sub_ns(due,
+							 priv->txtime_wakeup));
+			spin_unlock_irqrestore(&queue->lock, flags);
+			return HRTIMER_RESTART;
+		}
+		__skb_unlink(skb, queue);
+		spin_unlock_irqrestore(&queue->lock, flags);
+
+		if (wait > 0) {
+			spun = true;
+			while (ktime_before(ktime_get_clocktai(), due))
+				cpu_relax();
+		}
+		--budget;
+		if (!ccat_eth_txtime_xmit(priv, skb)
+		    && !ccat_eth_txtime_stall(priv, skb))
+			return HRTIMER_NORESTART;
+	}
+}
+
+static netdev_tx_t ccat_eth_start_xmit(struct sk_buff *skb,
+				       struct net_device *dev)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+
+	if (unlikely(priv->txtime_queues) && skb->tstamp
+	    && test_bit(skb_get_queue_mapping(skb), &priv->txtime_queues)
+	    && ccat_eth_txtime_enqueue(priv, skb))
+		return NETDEV_TX_OK;
+	return ccat_eth_xmit(skb, dev);
+}
+
+/**
+ * Self-test frames keep their own ethertype, so neither the sync_rtt
+ * learner nor the rx hooks take them for EtherCAT, but they are sent on
+ * the EtherCAT queue. The best-effort throttle would limit the test to
+ * CCAT_TX_BEST_EFFORT_DEPTH frames in flight, instead of the window.
+ */
+static inline bool ccat_eth_is_selftest(const struct ccat_eth_priv *const priv,
+					const struct sk_buff *const skb)
+{
+	const struct ethhdr *const eth = (const struct ethhdr *)skb->data;
+	const struct ccat_eth_selftest_hdr *const hdr =
+	    (const struct ccat_eth_selftest_hdr *)(eth + 1);
+
+	return priv->tx_fifo.loopback
+	    && skb_headlen(skb) >= ETH_HLEN + sizeof(*hdr)
+	    && eth->h_proto == htons(ETH_P_802_EX1)
+	    && hdr->magic == htonl(CCAT_SELFTEST_MAGIC);
+}
+
+/**
+ * Steer EtherCAT frames to the high priority queue, everything else is
+ * best-effort traffic. Self-test frames are the exception.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 19, 0)
+static u16 ccat_eth_select_queue(struct net_device *dev, struct sk_buff *skb,
+				 void *accel_priv,
+				 select_queue_fallback_t fallback)
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(5, 2, 0)
+static u16 ccat_eth_select_queue(struct net_device *dev, struct sk_buff *skb,
+				 struct net_device *sb_dev,
+				 select_queue_fallback_t fallback)
+#else
+static u16 ccat_eth_select_queue(struct net_device *dev, struct sk_buff *skb,
+				 struct net_device *sb_dev)
+#endif
+{
+	const struct ethhdr *const eth = (const struct ethhdr *)skb->data;
+
+	if (skb_headlen(skb) >= ETH_HLEN
+	    && eth->h_proto == htons(ETH_P_ETHERCAT))
+		return CCAT_TXQ_ETHERCAT;
+	if (unlikely(ccat_eth_is_selftest(netdev_priv(dev), skb)))
+		return CCAT_TXQ_ETHERCAT;
+	return CCAT_TXQ_BEST_EFFORT;
+}
+
+/**
+ * Function to transmit a raw buffer to the network (f.e. frameForwardEthernetFrames)
+ * @dev a valid net_device
+ * @data pointer to your raw buffer
+ * @len number of bytes in the raw buffer to transmit
+ */
+static void ccat_eth_xmit_raw(struct net_device *dev, const char *const data,
+			      size_t len)
+{
+	struct sk_buff *skb = dev_alloc_skb(len);
+
+	skb->dev = dev;
+	skb_copy_to_linear_data(skb, data, len);
+	skb_put(skb, len);
+	ccat_eth_start_xmit(skb, dev);
+}
+
+static __always_inline void ccat_eth_receive(struct ccat_eth_priv *const priv,
+					      const size_t len,
+					      const struct ccat_eth_fifo_operations *const rx_ops)
+{
+	struct sk_buff *const skb = napi_alloc_skb(&priv->napi, len);
+	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
+	struct net_device *const dev = priv->netdev;
+
+	if (!skb) {
+		pr_info("%s() out of memory :-(\n", __FUNCTION__);
+		atomic64_inc(&fifo->dropped);
+		return;
+	}
+	skb->dev = dev;
+	rx_ops->queue.copy_to_skb(fifo, skb, len);
+	skb_put(skb, len);
+	/* without in place access, the frame is recorded from the skb */
+	if (!rx_ops->frame)
+		ccat_flight_rx(priv, skb->data, len, rx_ops);
+	skb->protocol = eth_type_trans(skb, dev);
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+	atomic64_add(len, &fifo->bytes);
+	napi_gro_receive(&priv->napi, skb);
+}
+
+static inline struct ccat_dma_frame *ccat_eth_template_slot(const struct
+							   ccat_eth_priv
+							   *const priv,
+							   const unsigned int
+							   id)
+{
+	return priv->tx_fifo.dma.start + priv->tx_fifo.max_slots - 1 - id;
+}
+
+/**
+ * Templates occupy the slots from the end of the tx window downwards.
+ * @return number of slots below the lowest template, available to the ring
+ */
+static u32 ccat_eth_templates_floor(const struct ccat_eth_priv *const priv)
+{
+	const unsigned long last = find_last_bit(priv->templates, CCAT_DMA_SLOTS);
+
+	if (last >= CCAT_DMA_SLOTS)
+		return priv->tx_fifo.max_slots;
+	return priv->tx_fifo.max_slots - 1 - last;
+}
+
+/**
+ * A reset of the CCAT tx fifo drops pending templates, too. Mark them as
+ * sent, so they can be patched and sent again. Caller holds tx_lock.
+ */
+static void ccat_eth_templates_reset(struct ccat_eth_priv *const priv)
+{
+	unsigned int id;
+
+	for_each_set_bit(id, priv->templates, CCAT_DMA_SLOTS)
+	    ccat_eth_template_slot(priv, id)->hdr.tx_flags =
+	    cpu_to_le32(CCAT_FRAME_SENT);
+}
+
+#ifdef CCAT_ETH_URING
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 4, 0)
+#define ccat_uring_done(cmd, res, issue_flags) io_uring_cmd_done(cmd, res, 0)
+#else
+#define ccat_uring_done(cmd, res, issue_flags) \
+	io_uring_cmd_done(cmd, res, 0, issue_flags)
+#endif
+
+/**
+ * Commands pending with the napi side (cancel needs 6.7). Without, a
+ * pending command completes with the next event or when the interface
+ * goes down.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 7, 0)
+#define ccat_uring_mark_cancelable(cmd, issue_flags) do { } while (0)
+#else
+#define ccat_uring_mark_cancelable io_uring_cmd_mark_cancelable
+#endif
+
+/**
+ * struct ccat_eth_uring_pdu - driver data of a command in io_uring_cmd.pdu
+ * @node: SEND: entry in ccat_eth_uring.tx_pending
+ * @uring: RECV: state the frames are taken from
+ * @frames: RECV: userspace address of the frame table
+ * @count: number of frames
+ * @end: SEND: tx fifo index after the last frame
+ * @res: result, once the command left the napi side
+ */
+struct ccat_eth_uring_pdu {
+	union {
+		struct list_head node;
+		struct ccat_eth_uring *uring;
+	};
+	u64 frames;
+	u32 count;
+	union {
+		u32 end;
+		int res;
+	};
+};
+
+static inline struct ccat_eth_uring_pdu *ccat_uring_pdu(struct io_uring_cmd
+							*const cmd)
+{
+	BUILD_BUG_ON(sizeof(struct ccat_eth_uring_pdu) > sizeof(cmd->pdu));
+	return (struct ccat_eth_uring_pdu *)cmd->pdu;
+}
+
+static inline struct io_uring_cmd *ccat_uring_cmd(struct ccat_eth_uring_pdu
+						  *const pdu)
+{
+	return container_of((void *)pdu, struct io_uring_cmd, pdu);
+}
+
+/**
+ * Move received frames to the userspace buffers of a RECV command
+ * @return number of frames or -EFAULT if not even the first one was stored
+ */
+static int ccat_uring_copy_rx(struct ccat_eth_uring *const u,
+			      const struct ccat_eth_uring_pdu *const pdu)
+{
+	struct ccat_eth_uring_frame __user *const frames =
+	    u64_to_user_ptr(pdu->frames);
+	const u32 head = smp_load_acquire(&u->rx_head);
+	u32 tail = u->rx_tail;
+	int n;
+
+	for (n = 0; n < pdu->count && tail != head; ++n, ++tail) {
+		const u32 slot = tail % CCAT_ETH_URING_RX_FRAMES;
+		struct ccat_eth_uring_frame frame;
+		u32 len;
+
+		if (copy_from_user(&frame, &frames[n], sizeof(frame)))
+			break;
+		len = min_t(u32, frame.len, u->rx_len[slot]);
+		if (copy_to_user(u64_to_user_ptr(frame.addr), u->rx_buf[slot], len)
+		    || put_user(len, &frames[n].len))
+			break;
+		/* the slot is free for napi */
+		smp_store_release(&u->rx_tail, tail + 1);
+	}
+	return n ? n : -EFAULT;
+}
+
+/**
+ * Complete a command in the context of its task, where the RECV frames
+ * can be copied to userspace.
+ */
+static void __ccat_uring_task(struct io_uring_cmd *cmd, unsigned int issue_flags)
+{
+	struct ccat_eth_uring_pdu *const pdu = ccat_uring_pdu(cmd);
+	int res = pdu->res;
+
+	if (cmd->cmd_op == CCAT_ETH_URING_RECV) {
+		struct ccat_eth_uring *const u = pdu->uring;
+
+		if (!res)
+			res = ccat_uring_copy_rx(u, pdu);
+		clear_bit_unlock(0, &u->rx_busy);
+	}
+	ccat_uring_done(cmd, res, issue_flags);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 4, 0)
+static void ccat_uring_task(struct io_uring_cmd *cmd)
+{
+	__ccat_uring_task(cmd, 0);
+}
+#else
+#define ccat_uring_task __ccat_uring_task
+#endif
+
+/**
+ * Hand a command, which was taken from the napi side, back to its task
+ */
+static void ccat_uring_complete(struct io_uring_cmd *const cmd, const int res)
+{
+	ccat_uring_pdu(cmd)->res = res;
+	io_uring_cmd_complete_in_task(cmd, ccat_uring_task);
+}
+
+/**
+ * Complete all SEND commands and, if rx, the RECV command with res. Used
+ * when the fifos are reset or stopped. tx_lock orders this against
+ * ccat_eth_uring_send(), which tests the carrier and adds to tx_pending.
+ */
+static void ccat_eth_uring_flush(struct ccat_eth_priv *const priv,
+				 const int res, const bool rx)
+{
+	struct ccat_eth_uring_pdu *pdu, *tmp;
+	struct ccat_eth_uring *u;
+	unsigned long flags;
+
+	rcu_read_lock();
+	u = rcu_dereference(priv->uring);
+	if (u) {
+		spin_lock_irqsave(&priv->tx_lock, flags);
+		spin_lock(&u->lock);
+		list_for_each_entry_safe(pdu, tmp, &u->tx_pending, node) {
+			list_del(&pdu->node);
+			ccat_uring_complete(ccat_uring_cmd(pdu), res);
+		}
+		if (rx && u->rx_pending) {
+			ccat_uring_complete(u->rx_pending, res);
+			u->rx_pending = NULL;
+		}
+		spin_unlock(&u->lock);
+		spin_unlock_irqrestore(&priv->tx_lock, flags);
+	}
+	rcu_read_unlock();
+}
+
+/**
+ * Keep a received EtherCAT frame for RECV and wake the pending command.
+ * Called from napi.
+ * @return true if the frame was consumed and must not be passed to the stack
+ */
+static bool ccat_eth_uring_rx(struct ccat_eth_priv *const priv,
+			      const u8 *const frame, const size_t len)
+{
+	const struct ethhdr *const eth = (const struct ethhdr *)frame;
+	struct ccat_eth_uring *u;
+	bool consumed = false;
+
+	if (!READ_ONCE(priv->uring_rx) || len < ETH_HLEN
+	    || len > ETH_FRAME_LEN || eth->h_proto != htons(ETH_P_ETHERCAT))
+		return false;
+
+	rcu_read_lock();
+	u = rcu_dereference(priv->uring);
+	if (u) {
+		const u32 head = u->rx_head;
+
+		consumed = true;
+		if (head - smp_load_acquire(&u->rx_tail) <
+		    CCAT_ETH_URING_RX_FRAMES) {
+			const u32 slot = head % CCAT_ETH_URING_RX_FRAMES;
+
+			memcpy(u->rx_buf[slot], frame, len);
+			u->rx_len[slot] = len;
+			smp_store_release(&u->rx_head, head + 1);
+			atomic64_add(len, &priv->rx_fifo.bytes);
+
+			/* a RECV queued after this sees the new head */
+			spin_lock(&u->lock);
+			if (u->rx_pending) {
+				ccat_uring_complete(u->rx_pending, 0);
+				u->rx_pending = NULL;
+			}
+			spin_unlock(&u->lock);
+		} else {
+			atomic64_inc(&priv->rx_fifo.dropped);
+		}
+	}
+	rcu_read_unlock();
+	return consumed;
+}
+
+/**
+ * Complete the SEND commands whose frames were all sent. Called from napi
+ * after the tx fifo was reclaimed. A SEND may be added after its frames
+ * were already reclaimed, so this runs on every poll, not only if tail
+ * moved.
+ */
+static void ccat_eth_uring_tx_done(struct ccat_eth_priv *const priv)
+{
+	const u32 tail = priv->tx_fifo.tail;
+	struct ccat_eth_uring_pdu *pdu, *tmp;
+	struct ccat_eth_uring *u;
+
+	if (!rcu_access_pointer(priv->uring))
+		return;
+
+	rcu_read_lock();
+	u = rcu_dereference(priv->uring);
+	if (u && !list_empty_careful(&u->tx_pending)) {
+		spin_lock(&u->lock);
+		list_for_each_entry_safe(pdu, tmp, &u->tx_pending, node) {
+			if ((s32) (tail - pdu->end) < 0)
+				break;
+			list_del(&pdu->node);
+			ccat_uring_complete(ccat_uring_cmd(pdu), pdu->count);
+		}
+		spin_unlock(&u->lock);
+	}
+	rcu_read_unlock();
+}
+#else
+static inline void ccat_eth_uring_flush(struct ccat_eth_priv *const priv,
+					const int res, const bool rx)
+{
+}
+
+static inline bool ccat_eth_uring_rx(struct ccat_eth_priv *const priv,
+				     const u8 *const frame, const size_t len)
+{
+	return false;
+}
+
+static inline void ccat_eth_uring_tx_done(struct ccat_eth_priv *const priv)
+{
+}
+#endif
+
+/**
+ * Frames of the rx hook and io_uring RECV are exclusive, checked under rtnl
+ */
+static inline bool ccat_eth_uring_rx_on(const struct ccat_eth_priv *const priv)
+{
+#ifdef CCAT_ETH_URING
+	return priv->uring_rx;
+#else
+	return false;
+#endif
+}
+
+static void ccat_eth_link_down(struct net_device *const dev)
+{
+	netif_tx_stop_all_queues(dev);
+	netif_carrier_off(dev);
+	netdev_info(dev, "NIC Link is Down\n");
 }
 
 static void ccat_eth_link_up(struct net_device *const dev)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	unsigned long flags;
+
+	netdev_info(dev, "NIC Link is Up\n");
+	/* TODO netdev_info(dev, "NIC Link is Up %u Mbps %s Duplex\n",
+	   speed == SPEED_100 ? 100 : 10,
+	   cmd.duplex == DUPLEX_FULL ? "Full" : "Half"); */
+
+	/* we run in napi context, which owns the rx fifo and consumes the tx
+	 * fifo. tx_lock keeps ndo_start_xmit() on other CPUs away. */
+	ccat_eth_fifo_reset(&priv->rx_fifo);
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	ccat_eth_fifo_reset(&priv->tx_fifo);
+	ccat_eth_templates_reset(priv);
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+	/* the frames of pending SEND commands are gone */
+	ccat_eth_uring_flush(priv, -ENETRESET, false);
+
+	/* TODO reset CCAT MAC register */
+
+	ccat_eth_xmit_raw(dev, frameForwardEthernetFrames,
+			  sizeof(frameForwardEthernetFrames));
+	netif_carrier_on(dev);
+	netif_tx_start_all_queues(dev);
+}
+
+/**
+ * Read link state from CCAT hardware
+ * @return 1 if link is up, 0 if not
+ */
+inline static size_t ccat_eth_priv_read_link_state(const struct ccat_eth_priv
+						   *const priv)
+{
+	return ! !(ccat_ioread32(priv->reg.mii + 0x8 + 4) & (1 << 24));
+}
+
+/**
+ * Poll for link state changes
+ */
+static void poll_link(struct ccat_eth_priv *const priv)
+{
+	const size_t link = priv->tx_fifo.loopback
+	    || ccat_eth_priv_read_link_state(priv);
+
+	if (link != netif_carrier_ok(priv->netdev)) {
+		if (link)
+			ccat_eth_link_up(priv->netdev);
+		else
+			ccat_eth_link_down(priv->netdev);
+	}
+}
+
+/**
+ * Copy the registered datagrams of an EtherCAT frame straight from the rx
+ * slot into the process image.
+ * @return true if the frame was consumed and must not be passed to the stack
+ */
+static bool ccat_eth_pi_scatter(struct ccat_eth_priv *const priv,
+				const u8 *const frame, const size_t len)
+{
+	static const size_t dgrams_offset = ETH_HLEN + CCAT_ECAT_HDR_LEN;
+	const struct ethhdr *const eth = (const struct ethhdr *)frame;
+	const u8 *const dgrams = frame + dgrams_offset;
+	const struct ccat_pi *pi;
+	bool consumed = false;
+	u8 index;
+	u16 i;
+
+	if (!rcu_access_pointer(priv->pi))
+		return false;
+	if (len < dgrams_offset + CCAT_DGRAM_HDR_LEN
+	    || eth->h_proto != htons(ETH_P_ETHERCAT))
+		return false;
+
+	/* the index of the first datagram identifies the frame */
+	index = dgrams[1];
+	rcu_read_lock();
+	pi = rcu_dereference(priv->pi);
+	if (pi && pi->first[index] != pi->first[index + 1]) {
+		for (i = pi->first[index]; i < pi->first[index + 1]; ++i) {
+			const struct ccat_eth_pi_map *const map = &pi->map[i];
+			const u8 *const dgram = dgrams + map->datagram_offset;
+			const u8 *const data = dgram + CCAT_DGRAM_HDR_LEN;
+			__le16 dlen;
+
+			if (dgrams_offset + map->datagram_offset +
+			    CCAT_DGRAM_HDR_LEN + map->length +
+			    CCAT_DGRAM_WKC_LEN > len)
+				continue;
+			memcpy(&dlen, dgram + CCAT_DGRAM_LEN_OFFSET, sizeof(dlen));
+			if ((le16_to_cpu(dlen) & CCAT_DGRAM_LEN_MASK) != map->length)
+				continue;
+			memcpy(pi->image + map->pi_offset, data, map->length);
+			memcpy(pi->image + map->wkc_offset, data + map->length,
+			       CCAT_DGRAM_WKC_LEN);
+		}
+		consumed = true;
+	}
+	rcu_read_unlock();
+
+	if (consumed) {
+		atomic64_add(len, &priv->rx_fifo.bytes);
+		/* publish the process image before the completion */
+		smp_mb__before_atomic();
+		atomic64_inc(&priv->pi_seq);
+		wake_up_interruptible(&priv->pi_wait);
+	}
+	return consumed;
+}
+
+/**
+ * Pass a frame straight from the rx slot to the registered rx hook.
+ * @return true if the frame was consumed and must not be passed to the stack
+ */
+static bool ccat_eth_rx_hook(struct ccat_eth_priv *const priv,
+			     const u8 *const frame, const size_t len)
+{
+	const struct ethhdr *const eth = (const struct ethhdr *)frame;
+	const struct ccat_eth_rx_hook *hook;
+	bool consumed = false;
+
+	if (!rcu_access_pointer(priv->rx_hook) || len < ETH_HLEN)
+		return false;
+
+	rcu_read_lock();
+	hook = rcu_dereference(priv->rx_hook);
+	if (hook && eth->h_proto == hook->proto) {
+		hook->handler(hook->ctx, frame, len);
+		consumed = true;
+	}
+	rcu_read_unlock();
+
+	if (consumed)
+		atomic64_add(len, &priv->rx_fifo.bytes);
+	return consumed;
+}
+
+/**
+ * Deliver a frame without an skb, into the process image, to io_uring or to
+ * the rx hook. Frames claimed by none go to the network stack.
+ * @return true if the frame was consumed
+ */
+static inline bool ccat_eth_rx_steer(struct ccat_eth_priv *const priv,
+				     const u8 *const frame, const size_t len)
+{
+	return ccat_eth_pi_scatter(priv, frame, len)
+	    || ccat_eth_uring_rx(priv, frame, len)
+	    || ccat_eth_rx_hook(priv, frame, len);
+}
+
+/**
+ * Poll for available rx dma descriptors in ethernet operating mode.
+ * Consumed slots are handed back to CCAT in batches, once half of the
+ * ring is consumed and at the end of the poll.
+ * @return number of received frames, never more than budget
+ */
+static __always_inline int poll_rx(struct ccat_eth_priv *const priv,
+				    const int budget,
+				    const struct ccat_eth_fifo_operations *const rx_ops,
+				    const struct ccat_eth_fifo_operations *const tx_ops)
+{
+	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
+	const u32 watermark = (fifo->mask + 2) / 2;
+	int done = 0;
+	size_t len;
+
+	while (done < budget && (len = rx_ops->ready(fifo))) {
+		const u8 *const frame =
+		    rx_ops->frame ? rx_ops->frame(fifo, fifo->head) : NULL;
+
+		if (smp_load_acquire(&priv->sync_sample))
+			ccat_eth_sync_learn(priv, frame, len, rx_ops, tx_ops);
+		if (frame)
+			ccat_flight_rx(priv, frame, len, rx_ops);
+		if (!frame || !ccat_eth_rx_steer(priv, frame, len))
+			ccat_eth_receive(priv, len, rx_ops);
+		++fifo->head;
+		++done;
+		if (fifo->head - fifo->tail >= watermark)
+			rx_ops->refill(fifo, fifo->head);
+	}
+	if (fifo->head != fifo->tail)
+		rx_ops->refill(fifo, fifo->head);
+	return done;
+}
+
+/**
+ * Software loopback: pass the frames pending in the tx fifo to the rx
+ * path, as if CCAT had sent and received them, and mark their slots sent.
+ * They are read from the tx DMA slots, so the copy and skb costs match a
+ * real round trip.
+ */
+static void ccat_eth_reflect(struct ccat_eth_priv *const priv)
+{
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	struct net_device *const dev = priv->netdev;
+	const u32 head = smp_load_acquire(&fifo->head);
+	u32 i;
+
+	for (i = fifo->tail; i != head; ++i) {
+		struct ccat_dma_frame *const frame = fifo_dma_slot(fifo, i);
+		const size_t len = le16_to_cpu(frame->hdr.length);
+		struct sk_buff *skb;
+
+		if (le32_to_cpu(frame->hdr.tx_flags) & CCAT_FRAME_SENT)
+			continue;
+		frame->hdr.tx_flags = cpu_to_le32(CCAT_FRAME_SENT);
+		if (priv->flight[CCAT_FLIGHT_RX].rec)
+			ccat_flight_record(&priv->flight[CCAT_FLIGHT_RX],
+					   frame->data, len, i & fifo->mask);
+		if (ccat_eth_rx_steer(priv, frame->data, len))
+			continue;
+
+		skb = napi_alloc_skb(&priv->napi, len);
+		if (!skb) {
+			atomic64_inc(&priv->rx_fifo.dropped);
+			continue;
+		}
+		skb->dev = dev;
+		ccat_copy(priv->rx_fifo.copy, skb->data, frame->data, len);
+		skb_put(skb, len);
+		skb->protocol = eth_type_trans(skb, dev);
+		skb->ip_summed = CHECKSUM_UNNECESSARY;
+		atomic64_add(len, &priv->rx_fifo.bytes);
+		napi_gro_receive(&priv->napi, skb);
+	}
+}
+
+/**
+ * Poll for available tx dma descriptors in ethernet operating mode
+ */
+static __always_inline void poll_tx(struct ccat_eth_priv *const priv,
+				     const struct ccat_eth_fifo_operations *const tx_ops)
+{
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	struct net_device *const dev = priv->netdev;
+	const u32 tail = fifo->tail;
+	u32 end;
+
+	if (tx_ops == &dma_tx_fifo_ops && unlikely(fifo->loopback))
+		ccat_eth_reflect(priv);
+	end = tx_ops->sent(fifo);
+	ccat_flight_tx_done(priv, tail, end, tx_ops);
+	ccat_eth_sync_tx_done(priv, tail, end, tx_ops);
+	/* the slots are free for the producer */
+	smp_store_release(&fifo->tail, end);
+	ccat_eth_uring_tx_done(priv);
+	if (!netif_carrier_ok(dev))
+		return;
+
+	/* pairs with smp_mb() in ccat_eth_tx_throttle() and
+	 * ccat_eth_txtime_stall() */
+	smp_mb();
+	if (unlikely(READ_ONCE(priv->txtime_stalled)) && ccat_eth_tx_space(fifo)) {
+		WRITE_ONCE(priv->txtime_stalled, false);
+		hrtimer_start(&priv->txtime_timer, ktime_get_clocktai(),
+			      CCAT_TXTIME_MODE);
+	}
+	if (__netif_subqueue_stopped(dev, CCAT_TXQ_ETHERCAT)
+	    && ccat_eth_tx_space(fifo)) {
+		netif_wake_subqueue(dev, CCAT_TXQ_ETHERCAT);
+	}
+	if (__netif_subqueue_stopped(dev, CCAT_TXQ_BEST_EFFORT)
+	    && ccat_eth_tx_space(fifo) && tx_ops->shallow(fifo)) {
+		netif_wake_subqueue(dev, CCAT_TXQ_BEST_EFFORT);
+	}
+}
+
+/**
+ * Update the copy of the CCAT MAC register reported by ndo_get_stats64(),
+ * together with the byte counters, so packets and bytes match.
+ */
+static void poll_stats(struct ccat_eth_priv *const priv)
+{
+	struct ccat_mac_register mac;
+
+	ccat_memcpy_fromio(&mac, priv->reg.mac, sizeof(mac));
+	spin_lock_bh(&priv->stats_lock);
+	priv->mac = mac;
+	priv->mac_rx_bytes = atomic64_read(&priv->rx_fifo.bytes);
+	priv->mac_tx_bytes = atomic64_read(&priv->tx_fifo.bytes);
+	priv->mac_jiffies = jiffies;
+	spin_unlock_bh(&priv->stats_lock);
+}
+
+/**
+ * NAPI poll, scheduled by poll_timer or called directly from a busy polling
+ * socket (SO_BUSY_POLL, epoll busy poll). Since all rx fifo access happens
+ * here, a link change resetting the fifos is handled here, too.
+ * Housekeeping tasks only run when poll_timer found them due, so busy
+ * polling touches nothing but the fifos.
+ */
+static int ccat_eth_napi_poll(struct napi_struct *napi, int budget)
+{
+	struct ccat_eth_priv *const priv =
+	    container_of(napi, struct ccat_eth_priv, napi);
+	const int rx_budget = min_t(int, budget, READ_ONCE(priv->rx_budget));
+	int done;
+
+	if (test_and_clear_bit(CCAT_TASK_LINK, &priv->tasks_pending))
+		poll_link(priv);
+	if (test_and_clear_bit(CCAT_TASK_STATS, &priv->tasks_pending))
+		poll_stats(priv);
+	if (ccat_eth_is_dma(priv)) {
+		done = poll_rx(priv, rx_budget, &dma_rx_fifo_ops,
+			       &dma_tx_fifo_ops);
+		poll_tx(priv, &dma_tx_fifo_ops);
+	} else {
+		done = poll_rx(priv, rx_budget, &eim_rx_fifo_ops,
+			       &eim_tx_fifo_ops);
+		poll_tx(priv, &eim_tx_fifo_ops);
+	}
+
+	if (done < budget) {
+		/* keep busy polling until the response arrived */
+		if (!done && ktime_before(ktime_get(), READ_ONCE(priv->sync_until)))
+			return budget;
+		WRITE_ONCE(priv->sync_until, 0);
+		napi_complete_done(napi, done);
+	}
+	return done;
+}
+
+/**
+ * Since CCAT doesn't support interrupts until now, we have to poll
+ * some status bits to recognize things like link change etc.
+ */
+static enum hrtimer_restart poll_timer_callback(struct hrtimer *timer)
+{
+	struct ccat_eth_priv *const priv =
+	    container_of(timer, struct ccat_eth_priv, poll_timer);
+	struct ccat_eth_fifo *const rx_fifo = &priv->rx_fifo;
+	struct ccat_eth_fifo *const tx_fifo = &priv->tx_fifo;
+	const unsigned long now = jiffies;
+	size_t i;
+
+	for (i = 0; i < CCAT_TASK_COUNT; ++i) {
+		struct ccat_eth_task *const task = &priv->tasks[i];
+
+		if (time_after_eq(now, task->next)) {
+			task->next = now + task->period;
+			set_bit(i, &priv->tasks_pending);
+		}
+	}
+
+	/* avoid raising the softirq for an idle port */
+	if (READ_ONCE(priv->tasks_pending)
+	    || (ccat_eth_is_dma(priv) ? fifo_dma_rx_ready(rx_fifo) :
+		fifo_eim_rx_ready(rx_fifo))
+	    || READ_ONCE(tx_fifo->head) != READ_ONCE(tx_fifo->tail))
+		napi_schedule(&priv->napi);
+
+	hrtimer_forward_now(timer, priv->poll_period);
+	return HRTIMER_RESTART;
+}
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0))
+static struct rtnl_link_stats64 *ccat_eth_get_stats64(struct net_device *dev, struct rtnl_link_stats64
+						      *storage)
+#else
+static void ccat_eth_get_stats64(struct net_device *dev,
+				 struct rtnl_link_stats64 *storage)
+#endif
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	struct ccat_mac_register mac;
+	const unsigned long updated = READ_ONCE(priv->mac_jiffies);
+	u64 rx_bytes, tx_bytes;
+
+	/* the stats task doesn't run while down, or didn't run, yet */
+	if (!netif_running(dev) || !updated
+	    || time_after(jiffies, updated + msecs_to_jiffies(stats_ms)))
+		poll_stats(priv);
+
+	spin_lock_bh(&priv->stats_lock);
+	mac = priv->mac;
+	rx_bytes = priv->mac_rx_bytes;
+	tx_bytes = priv->mac_tx_bytes;
+	spin_unlock_bh(&priv->stats_lock);
+	storage->rx_packets = mac.rx_frames;	/* total packets received       */
+	storage->tx_packets = mac.tx_frames;	/* total packets transmitted    */
+	storage->rx_bytes = rx_bytes;	/* total bytes received         */
+	storage->tx_bytes = tx_bytes;	/* total bytes transmitted      */
+	storage->rx_errors = mac.frame_len_err + mac.rx_mem_full + mac.crc_err + mac.rx_err;	/* bad packets received         */
+	storage->tx_errors = mac.tx_mem_full;	/* packet transmit problems     */
+	storage->rx_dropped = atomic64_read(&priv->rx_fifo.dropped);	/* no space in linux buffers    */
+	storage->tx_dropped = atomic64_read(&priv->tx_fifo.dropped);	/* no space available in linux  */
+	//TODO __u64    multicast;              /* multicast packets received   */
+	//TODO __u64    collisions;
+
+	/* detailed rx_errors: */
+	storage->rx_length_errors = mac.frame_len_err;
+	storage->rx_over_errors = mac.rx_mem_full;	/* receiver ring buff overflow  */
+	storage->rx_crc_errors = mac.crc_err;	/* recved pkt with crc error    */
+	storage->rx_frame_errors = mac.rx_err;	/* recv'd frame alignment error */
+	storage->rx_fifo_errors = mac.rx_mem_full;	/* recv'r fifo overrun          */
+	//TODO __u64    rx_missed_errors;       /* receiver missed packet       */
+
+	/* detailed tx_errors */
+	//TODO __u64    tx_aborted_errors;
+	//TODO __u64    tx_carrier_errors;
+	//TODO __u64    tx_fifo_errors;
+	//TODO __u64    tx_heartbeat_errors;
+	//TODO __u64    tx_window_errors;
+
+	/* for cslip etc */
+	//TODO __u64    rx_compressed;
+	//TODO __u64    tx_compressed;
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0))
+	return storage;
+#endif
+}
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(6,13,0))
+static void hrtimer_setup(struct hrtimer *timer, enum hrtimer_restart (*function)(struct hrtimer *), clockid_t clock_id, enum hrtimer_mode mode)
+{
+	hrtimer_init(timer, clock_id, mode);
+	timer->function = function;
+}
+#endif
+
+/**
+ * Any online CPU of the NUMA node the CCAT is attached to
+ * @return the CPU or -1 without node information
+ */
+static int ccat_eth_local_cpu(const struct ccat_function *const func)
+{
+	const int node = dev_to_node(func->ccat->dev);
+	unsigned int cpu;
+
+	if (node == NUMA_NO_NODE)
+		return -1;
+	cpu = cpumask_any_and(cpumask_of_node(node), cpu_online_mask);
+	return (cpu < nr_cpu_ids) ? cpu : -1;
+}
+
+static void ccat_eth_poll_start(void *data)
+{
+	struct ccat_eth_priv *const priv = data;
+
+	hrtimer_start(&priv->poll_timer, priv->poll_period,
+		      HRTIMER_MODE_REL_PINNED);
+}
+
+/**
+ * Start poll_timer pinned to poll_cpu or a CPU local to the CCAT, so the
+ * fifo polling and napi, which is scheduled from there, don't access the
+ * DMA memory across nodes. Without node information the timer is free to
+ * move, as before.
+ */
+static void ccat_eth_poll_timer_start(struct ccat_eth_priv *const priv)
+{
+	int cpu = READ_ONCE(poll_cpu);
+
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu))
+		cpu = ccat_eth_local_cpu(priv->func);
+	if (cpu < 0) {
+		hrtimer_start(&priv->poll_timer, priv->poll_period,
+			      HRTIMER_MODE_REL);
+		return;
+	}
+	netdev_dbg(priv->netdev, "polling on CPU %d\n", cpu);
+	if (smp_call_function_single(cpu, ccat_eth_poll_start, priv, 1))
+		ccat_eth_poll_start(priv);
+}
+
+static int ccat_eth_open(struct net_device *dev)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+
+	/* run all housekeeping tasks with the first tick */
+	priv->tasks[CCAT_TASK_LINK].period = msecs_to_jiffies(link_ms);
+	priv->tasks[CCAT_TASK_STATS].period = msecs_to_jiffies(stats_ms);
+	priv->tasks[CCAT_TASK_LINK].next = jiffies;
+	priv->tasks[CCAT_TASK_STATS].next = jiffies;
+	priv->poll_period = ns_to_ktime(max(poll_us, 1U) * NSEC_PER_USEC);
+	priv->sync_window =
+	    sync_rx ? clamp_t(u32, sync_window_ns, 1, CCAT_SYNC_MAX_WINDOW_NS) : 0;
+	priv->sync_learn = !sync_rtt_ns;
+	priv->sync_rtt = sync_rtt_ns;
+	priv->sync_sample = false;
+	priv->sync_until = 0;
+
+	napi_enable(&priv->napi);
+	hrtimer_setup(&priv->sync_timer, sync_timer_callback, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL_PINNED);
+	priv->txtime_stalled = false;
+	hrtimer_setup(&priv->txtime_timer, txtime_timer_callback, CLOCK_TAI,
+		      CCAT_TXTIME_MODE);
+	hrtimer_setup(&priv->poll_timer, poll_timer_callback, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ccat_eth_poll_timer_start(priv);
+	return 0;
+}
+
+static int ccat_eth_stop(struct net_device *dev)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+
+	/* waits for ndo_start_xmit(), which might arm sync_timer */
+	netif_tx_disable(dev);
+	hrtimer_cancel(&priv->poll_timer);
+	priv->sync_window = 0;
+	hrtimer_cancel(&priv->sync_timer);
+	napi_disable(&priv->napi);
+	/* poll_tx() restarts a stalled txtime_timer */
+	hrtimer_cancel(&priv->txtime_timer);
+	skb_queue_purge(&priv->txtime_queue);
+	/* let ccat_eth_open() detect the link again, which restarts the fifos */
+	netif_carrier_off(dev);
+	ccat_eth_uring_flush(priv, -ENETDOWN, true);
+	return 0;
+}
+
+/**
+ * Counterpart of napi_disable() around a fifo reset of a running
+ * interface, done with tx_lock held. The rest of the open state stays.
+ */
+static void ccat_eth_fifo_resume(struct ccat_eth_priv *const priv)
+{
+	struct net_device *const dev = priv->netdev;
+
+	/* the frames of pending SEND commands are gone */
+	ccat_eth_uring_flush(priv, -ENETRESET, false);
+	napi_enable(&priv->napi);
+	if (netif_carrier_ok(dev))
+		netif_tx_wake_all_queues(dev);
+}
+
+/**
+ * Switch the software loopback. On a running interface the tx fifo is
+ * reset like on a link change, so no frame is left without its doorbell
+ * or waiting for a reflection that never comes. With napi disabled and
+ * tx_lock held, neither poll_tx() nor a sender touches it meanwhile. The
+ * link is forced up while the loopback is enabled.
+ */
+static void ccat_eth_set_loopback(struct net_device *dev, const bool enable)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	const bool running = netif_running(dev);
+	unsigned long flags;
+
+	if (running)
+		napi_disable(&priv->napi);
+
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	if (running) {
+		ccat_eth_fifo_reset(&priv->tx_fifo);
+		ccat_eth_templates_reset(priv);
+	}
+	priv->tx_fifo.loopback = enable;
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+
+	if (running)
+		ccat_eth_fifo_resume(priv);
+}
+
+static int ccat_eth_set_features(struct net_device *dev,
+				 netdev_features_t features)
+{
+	const netdev_features_t changed = dev->features ^ features;
+
+	if (changed & NETIF_F_LOOPBACK)
+		ccat_eth_set_loopback(dev, !!(features & NETIF_F_LOOPBACK));
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 19, 0)
+/**
+ * Enable scheduled transmit per TX queue for the etf qdisc in offload mode
+ */
+static int ccat_eth_setup_tc(struct net_device *dev, enum tc_setup_type type,
+			     void *type_data)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	const struct tc_etf_qopt_offload *const qopt = type_data;
+
+	if (type != TC_SETUP_QDISC_ETF)
+		return -EOPNOTSUPP;
+	if (qopt->queue < 0 || qopt->queue >= CCAT_TXQ_COUNT)
+		return -EINVAL;
+
+	if (qopt->enable)
+		set_bit(qopt->queue, &priv->txtime_queues);
+	else
+		clear_bit(qopt->queue, &priv->txtime_queues);
+	return 0;
+}
+#endif
+
+static const struct net_device_ops ccat_eth_netdev_ops = {
+	.ndo_get_stats64 = ccat_eth_get_stats64,
+	.ndo_open = ccat_eth_open,
+	.ndo_start_xmit = ccat_eth_start_xmit,
+	.ndo_select_queue = ccat_eth_select_queue,
+	.ndo_stop = ccat_eth_stop,
+	.ndo_set_features = ccat_eth_set_features,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 19, 0)
+	.ndo_setup_tc = ccat_eth_setup_tc,
+#endif
+};
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0)
+static void ccat_eth_get_ringparam(struct net_device *dev,
+				   struct ethtool_ringparam *ring)
+#else
+static void ccat_eth_get_ringparam(struct net_device *dev,
+				   struct ethtool_ringparam *ring,
+				   struct kernel_ethtool_ringparam *kernel_ring,
+				   struct netlink_ext_ack *extack)
+#endif
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+
+	ring->rx_max_pending = priv->rx_fifo.max_slots;
+	ring->tx_max_pending = priv->tx_fifo.max_slots;
+	ring->rx_pending = priv->rx_fifo.mask + 1;
+	ring->tx_pending = priv->tx_fifo.mask + 1;
+}
+
+/**
+ * Change the number of rx/tx slots in use. The slot size is fixed, since
+ * CCAT writes up to a full ethernet frame into each rx slot. Both fifos
+ * are reset, on a running interface with napi disabled and tx_lock held,
+ * like on a link change.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0)
+static int ccat_eth_set_ringparam(struct net_device *dev,
+				  struct ethtool_ringparam *ring)
+#else
+static int ccat_eth_set_ringparam(struct net_device *dev,
+				  struct ethtool_ringparam *ring,
+				  struct kernel_ethtool_ringparam *kernel_ring,
+				  struct netlink_ext_ack *extack)
+#endif
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	const bool running = netif_running(dev);
+	unsigned long flags;
+
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending)
+		return -EINVAL;
+	if (!ring->rx_pending || ring->rx_pending > priv->rx_fifo.max_slots)
+		return -EINVAL;
+	if (!ring->tx_pending || ring->tx_pending > priv->tx_fifo.max_slots)
+		return -EINVAL;
+	if (rounddown_pow_of_two(ring->tx_pending) > ccat_eth_templates_floor(priv))
+		return -EBUSY;
+
+	if (running)
+		napi_disable(&priv->napi);
+
+	fifo_set_slots(&priv->rx_fifo, ring->rx_pending);
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	fifo_set_slots(&priv->tx_fifo, ring->tx_pending);
+	ccat_eth_templates_reset(priv);
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+
+	if (running)
+		ccat_eth_fifo_resume(priv);
+
+	if (ring->rx_pending != priv->rx_fifo.mask + 1
+	    || ring->tx_pending != priv->tx_fifo.mask + 1)
+		netdev_info(dev, "ring sizes rounded to rx %u tx %u\n",
+			    priv->rx_fifo.mask + 1, priv->tx_fifo.mask + 1);
+	return 0;
+}
+
+/**
+ * rx-frames is the per poll rx budget, bounding the time a single napi
+ * poll may spend copying frames.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 15, 0)
+static int ccat_eth_get_coalesce(struct net_device *dev,
+				 struct ethtool_coalesce *ec)
+#else
+static int ccat_eth_get_coalesce(struct net_device *dev,
+				 struct ethtool_coalesce *ec,
+				 struct kernel_ethtool_coalesce *kernel_coal,
+				 struct netlink_ext_ack *extack)
+#endif
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+
+	ec->rx_max_coalesced_frames = READ_ONCE(priv->rx_budget);
+	return 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 15, 0)
+static int ccat_eth_set_coalesce(struct net_device *dev,
+				 struct ethtool_coalesce *ec)
+#else
+static int ccat_eth_set_coalesce(struct net_device *dev,
+				 struct ethtool_coalesce *ec,
+				 struct kernel_ethtool_coalesce *kernel_coal,
+				 struct netlink_ext_ack *extack)
+#endif
 {
 	struct ccat_eth_priv *const priv = netdev_priv(dev);
 
-	netdev_info(dev, "NIC Link is Up\n");
-	/* TODO netdev_info(dev, "NIC Link is Up %u Mbps %s Duplex\n",
-	   speed == SPEED_100 ? 100 : 10,
-	   cmd.duplex == DUPLEX_FULL ? "Full" : "Half"); */
+	if (!ec->rx_max_coalesced_frames
+	    || ec->rx_max_coalesced_frames > CCAT_NAPI_WEIGHT)
+		return -EINVAL;
+
+	WRITE_ONCE(priv->rx_budget, ec->rx_max_coalesced_frames);
+	return 0;
+}
+
+static const struct net_device_ops ccat_eth_netdev_ops;
+
+/**
+ * Resolve a network device passed to the template API
+ */
+static struct ccat_eth_priv *ccat_eth_export_priv(struct net_device *dev)
+{
+	struct ccat_eth_priv *priv;
+
+	if (!dev || dev->netdev_ops != &ccat_eth_netdev_ops)
+		return ERR_PTR(-ENODEV);
+
+	priv = netdev_priv(dev);
+	if (!ccat_eth_is_dma(priv))
+		return ERR_PTR(-EOPNOTSUPP);
+	return priv;
+}
+
+static struct ccat_dma_frame *ccat_eth_template_get(const struct ccat_eth_priv
+						    *const priv,
+						    const unsigned int id)
+{
+	if (id >= CCAT_DMA_SLOTS || !test_bit(id, priv->templates))
+		return NULL;
+	return ccat_eth_template_slot(priv, id);
+}
+
+/**
+ * ccat_eth_template_add() - pin a frame in a tx DMA slot for cyclic sending
+ * @dev: a CCAT network device in DMA mode
+ * @data: the complete ethernet frame
+ * @len: number of bytes in data
+ *
+ * Templates use the DMA slots above the tx ring, so the ring has to be
+ * shrunk with "ethtool -G <dev> tx <n>" first. Calls for one template have
+ * to be serialized by the caller.
+ *
+ * Return: a template id or a negative errno
+ */
+int ccat_eth_template_add(struct net_device *dev, const void *data, size_t len)
+{
+	struct ccat_eth_priv *const priv = ccat_eth_export_priv(dev);
+	struct ccat_dma_frame *frame;
+	unsigned long flags;
+	unsigned int id;
+
+	if (IS_ERR(priv))
+		return PTR_ERR(priv);
+	if (!len || len > MAX_PAYLOAD_SIZE)
+		return -EINVAL;
+
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	id = find_first_zero_bit(priv->templates, CCAT_DMA_SLOTS);
+	if (id >= CCAT_DMA_SLOTS
+	    || priv->tx_fifo.max_slots - 1 - id <= priv->tx_fifo.mask) {
+		spin_unlock_irqrestore(&priv->tx_lock, flags);
+		return -ENOSPC;
+	}
+	frame = ccat_eth_template_slot(priv, id);
+	frame->hdr.length = cpu_to_le16(len);
+	frame->hdr.tx_flags = cpu_to_le32(CCAT_FRAME_SENT);
+	memcpy(frame->data, data, len);
+	priv->template_len[id] = len;
+	set_bit(id, priv->templates);
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+	return id;
+}
+
+EXPORT_SYMBOL(ccat_eth_template_add);
+
+/**
+ * ccat_eth_template_patch() - update bytes of a template, f.e. process data
+ * @dev: a CCAT network device in DMA mode
+ * @id: template id returned by ccat_eth_template_add()
+ * @offset: offset into the frame
+ * @data: new content
+ * @len: number of bytes in data
+ *
+ * Return: 0 or -EBUSY, while the template is still being sent
+ */
+int ccat_eth_template_patch(struct net_device *dev, unsigned int id,
+			    size_t offset, const void *data, size_t len)
+{
+	struct ccat_eth_priv *const priv = ccat_eth_export_priv(dev);
+	struct ccat_dma_frame *frame;
+
+	if (IS_ERR(priv))
+		return PTR_ERR(priv);
+	frame = ccat_eth_template_get(priv, id);
+	if (!frame)
+		return -ENOENT;
+	if (offset > priv->template_len[id]
+	    || len > priv->template_len[id] - offset)
+		return -EINVAL;
+	if (!(le32_to_cpu(READ_ONCE(frame->hdr.tx_flags)) & CCAT_FRAME_SENT))
+		return -EBUSY;
+
+	memcpy(frame->data + offset, data, len);
+	return 0;
+}
+
+EXPORT_SYMBOL(ccat_eth_template_patch);
+
+/**
+ * ccat_eth_template_send() - queue a template with a single CCAT fifo write
+ * @dev: a CCAT network device in DMA mode
+ * @id: template id returned by ccat_eth_template_add()
+ *
+ * Return: 0, -EBUSY if the previous send didn't complete or -ENETDOWN
+ */
+int ccat_eth_template_send(struct net_device *dev, unsigned int id)
+{
+	struct ccat_eth_priv *const priv = ccat_eth_export_priv(dev);
+	struct ccat_eth_fifo *fifo;
+	struct ccat_dma_frame *frame;
+	unsigned long flags;
+	int status = 0;
+
+	if (IS_ERR(priv))
+		return PTR_ERR(priv);
+	frame = ccat_eth_template_get(priv, id);
+	if (!frame)
+		return -ENOENT;
+	if (!netif_carrier_ok(dev))
+		return -ENETDOWN;
+
+	fifo = &priv->tx_fifo;
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	if (le32_to_cpu(frame->hdr.tx_flags) & CCAT_FRAME_SENT) {
+		frame->hdr.tx_flags = cpu_to_le32(0);
+		ccat_iowrite32(fifo_dma_tx_doorbell
+			       (fifo, frame, priv->template_len[id]), fifo->reg);
+		/* template slots are outside the fifo, no CCAT timestamp */
+		if (priv->flight[CCAT_FLIGHT_TX].rec)
+			ccat_flight_record(&priv->flight[CCAT_FLIGHT_TX],
+					   frame->data, priv->template_len[id],
+					   frame - fifo->dma.start);
+		atomic64_add(priv->template_len[id], &fifo->bytes);
+	} else {
+		status = -EBUSY;
+	}
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+	return status;
+}
+
+EXPORT_SYMBOL(ccat_eth_template_send);
+
+/**
+ * ccat_eth_template_remove() - release a template slot
+ * @dev: a CCAT network device in DMA mode
+ * @id: template id returned by ccat_eth_template_add()
+ *
+ * Return: 0 or -EBUSY, while the template is still being sent
+ */
+int ccat_eth_template_remove(struct net_device *dev, unsigned int id)
+{
+	struct ccat_eth_priv *const priv = ccat_eth_export_priv(dev);
+	struct ccat_dma_frame *frame;
+	unsigned long flags;
+	int status = 0;
+
+	if (IS_ERR(priv))
+		return PTR_ERR(priv);
+
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	frame = ccat_eth_template_get(priv, id);
+	if (!frame)
+		status = -ENOENT;
+	else if (!(le32_to_cpu(frame->hdr.tx_flags) & CCAT_FRAME_SENT))
+		status = -EBUSY;
+	else
+		clear_bit(id, priv->templates);
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+	return status;
+}
+
+EXPORT_SYMBOL(ccat_eth_template_remove);
+
+/**
+ * ccat_eth_rx_register() - receive one EtherType without skbs
+ * @dev: a CCAT network device in DMA mode
+ * @proto: EtherType in host byte order, e.g. ETH_P_ETHERCAT
+ * @handler: called from napi (softirq) for each matching frame
+ * @ctx: passed to handler
+ *
+ * The frame passed to handler points into the rx DMA slot and is only
+ * valid until handler returns. All other frames, and frames claimed by the
+ * process image of /dev/ccat_eth<n>, bypass the handler. Only one handler
+ * can be registered per device.
+ *
+ * Return: 0 or a negative errno
+ */
+int ccat_eth_rx_register(struct net_device *dev, u16 proto,
+			 ccat_eth_rx_handler_t handler, void *ctx)
+{
+	struct ccat_eth_priv *const priv = ccat_eth_export_priv(dev);
+	struct ccat_eth_rx_hook *hook;
+
+	if (IS_ERR(priv))
+		return PTR_ERR(priv);
+	if (!handler)
+		return -EINVAL;
+
+	hook = kzalloc(sizeof(*hook), GFP_KERNEL);
+	if (!hook)
+		return -ENOMEM;
+	hook->proto = htons(proto);
+	hook->handler = handler;
+	hook->ctx = ctx;
+
+	rtnl_lock();
+	if (rtnl_dereference(priv->rx_hook) || ccat_eth_uring_rx_on(priv)) {
+		rtnl_unlock();
+		kfree(hook);
+		return -EBUSY;
+	}
+	rcu_assign_pointer(priv->rx_hook, hook);
+	rtnl_unlock();
+	return 0;
+}
+
+EXPORT_SYMBOL(ccat_eth_rx_register);
+
+/**
+ * ccat_eth_rx_unregister() - stop receiving with ccat_eth_rx_register()
+ * @dev: a CCAT network device in DMA mode
+ *
+ * Waits until napi left the handler, so its module can be unloaded after
+ * this returns. Must not be called from atomic context.
+ */
+void ccat_eth_rx_unregister(struct net_device *dev)
+{
+	struct ccat_eth_priv *const priv = ccat_eth_export_priv(dev);
+	struct ccat_eth_rx_hook *hook;
+
+	if (IS_ERR(priv))
+		return;
+
+	rtnl_lock();
+	hook = rtnl_dereference(priv->rx_hook);
+	RCU_INIT_POINTER(priv->rx_hook, NULL);
+	rtnl_unlock();
+
+	synchronize_rcu();
+	kfree(hook);
+}
+
+EXPORT_SYMBOL(ccat_eth_rx_unregister);
+
+enum ccat_eth_test_id {
+	CCAT_TEST_LOOPBACK,
+	CCAT_TEST_PPS,
+	CCAT_TEST_BYTES,
+	CCAT_TEST_LATENCY_AVG,
+	CCAT_TEST_LATENCY_MAX,
+	CCAT_TEST_COUNT
+};
+
+static const char ccat_eth_test_names[CCAT_TEST_COUNT][ETH_GSTRING_LEN] = {
+	"loopback lost frames (offline)",
+	"loopback frames/s",
+	"loopback bytes/s",
+	"loopback latency avg ns",
+	"loopback latency max ns",
+};
+
+/**
+ * struct ccat_eth_selftest - state of a running self-test
+ * @pt: receives the reflected test frames from the stack
+ * @wait: the sender waits here for free slots in the window
+ * @received: number of test frames received
+ * @bytes: number of bytes received
+ * @latency_sum: sum of the per-frame latencies in ns
+ * @latency_max: maximum per-frame latency in ns
+ */
+struct ccat_eth_selftest {
+	struct packet_type pt;
+	wait_queue_head_t wait;
+	atomic_t received;
+	atomic64_t bytes;
+	atomic64_t latency_sum;
+	u64 latency_max;
+};
+
+static int ccat_eth_selftest_rcv(struct sk_buff *skb, struct net_device *dev,
+				 struct packet_type *pt,
+				 struct net_device *orig_dev)
+{
+	struct ccat_eth_selftest *const test =
+	    container_of(pt, struct ccat_eth_selftest, pt);
+	const struct ccat_eth_selftest_hdr *hdr;
+	u64 latency;
+
+	if (!pskb_may_pull(skb, sizeof(*hdr)))
+		goto out;
+	hdr = (const struct ccat_eth_selftest_hdr *)skb->data;
+	if (hdr->magic != htonl(CCAT_SELFTEST_MAGIC))
+		goto out;
+
+	/* napi of this device is the only caller, no concurrent update */
+	latency = ktime_get_ns() - hdr->timestamp;
+	atomic64_add(latency, &test->latency_sum);
+	if (latency > test->latency_max)
+		test->latency_max = latency;
+	atomic64_add(skb->len + ETH_HLEN, &test->bytes);
+	atomic_inc(&test->received);
+	wake_up(&test->wait);
+out:
+	kfree_skb(skb);
+	return NET_RX_SUCCESS;
+}
+
+static struct sk_buff *ccat_eth_selftest_frame(struct net_device *dev,
+					       const size_t len, const u32 seq)
+{
+	struct sk_buff *const skb = netdev_alloc_skb(dev, len);
+	struct ccat_eth_selftest_hdr *hdr;
+	struct ethhdr *eth;
+
+	if (!skb)
+		return NULL;
+
+	eth = (struct ethhdr *)skb_put(skb, len);
+	memset(eth, 0, len);
+	ether_addr_copy(eth->h_dest, dev->dev_addr);
+	ether_addr_copy(eth->h_source, dev->dev_addr);
+	eth->h_proto = htons(ETH_P_802_EX1);
+	hdr = (struct ccat_eth_selftest_hdr *)(eth + 1);
+	hdr->magic = htonl(CCAT_SELFTEST_MAGIC);
+	hdr->seq = seq;
+	hdr->timestamp = ktime_get_ns();
+
+	skb->dev = dev;
+	skb->protocol = htons(ETH_P_802_EX1);
+	return skb;
+}
+
+/**
+ * Send test frames through the stack and the software loopback and
+ * measure frame rate, throughput and per-frame latency.
+ */
+static void ccat_eth_selftest_run(struct net_device *dev, u64 * data)
+{
+	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	const bool loopback = priv->tx_fifo.loopback;
+	const size_t len = clamp_t(size_t, READ_ONCE(selftest_len),
+				   ETH_HLEN +
+				   sizeof(struct ccat_eth_selftest_hdr),
+				   ETH_FRAME_LEN);
+	struct ccat_eth_selftest *test;
+	u64 start, elapsed;
+	u32 sent, received;
+	int i;
+
+	test = kzalloc(sizeof(*test), GFP_KERNEL);
+	if (!test) {
+		data[CCAT_TEST_LOOPBACK] = CCAT_SELFTEST_FRAMES;
+		return;
+	}
+	init_waitqueue_head(&test->wait);
+	test->pt.type = htons(ETH_P_802_EX1);
+	test->pt.dev = dev;
+	test->pt.func = ccat_eth_selftest_rcv;
+
+	if (!loopback)
+		ccat_eth_set_loopback(dev, true);
+	/* the next link task brings the forced link up */
+	for (i = 0; i < 100 && !netif_carrier_ok(dev); ++i)
+		msleep(10);
+
+	dev_add_pack(&test->pt);
+	start = ktime_get_ns();
+	for (sent = 0; sent < CCAT_SELFTEST_FRAMES; ++sent) {
+		struct sk_buff *skb;
+
+		if (!wait_event_timeout(test->wait,
+					sent - atomic_read(&test->received) <
+					CCAT_SELFTEST_WINDOW, HZ))
+			break;
+		skb = ccat_eth_selftest_frame(dev, len, sent);
+		if (!skb)
+			break;
+		dev_queue_xmit(skb);
+	}
+	wait_event_timeout(test->wait, atomic_read(&test->received) == sent,
+			   HZ);
+	elapsed = max_t(u64, ktime_get_ns() - start, 1);
+	/* waits for ccat_eth_selftest_rcv() to return on all CPUs */
+	dev_remove_pack(&test->pt);
+
+	if (!loopback)
+		ccat_eth_set_loopback(dev, false);
+
+	received = atomic_read(&test->received);
+	data[CCAT_TEST_LOOPBACK] = CCAT_SELFTEST_FRAMES - received;
+	data[CCAT_TEST_PPS] = div64_u64((u64) received * NSEC_PER_SEC, elapsed);
+	data[CCAT_TEST_BYTES] =
+	    div64_u64(atomic64_read(&test->bytes) * NSEC_PER_SEC, elapsed);
+	if (received) {
+		data[CCAT_TEST_LATENCY_AVG] =
+		    div_u64(atomic64_read(&test->latency_sum), received);
+		data[CCAT_TEST_LATENCY_MAX] = test->latency_max;
+	}
+	kfree(test);
+}
+
+static void ccat_eth_self_test(struct net_device *dev,
+			       struct ethtool_test *etest, u64 * data)
+{
+	memset(data, 0, sizeof(*data) * CCAT_TEST_COUNT);
+
+	/* the loopback takes the port off the wire */
+	if (!(etest->flags & ETH_TEST_FL_OFFLINE))
+		return;
+
+	if (!netif_running(dev)) {
+		data[CCAT_TEST_LOOPBACK] = CCAT_SELFTEST_FRAMES;
+		etest->flags |= ETH_TEST_FL_FAILED;
+		return;
+	}
+
+	ccat_eth_selftest_run(dev, data);
+	if (data[CCAT_TEST_LOOPBACK])
+		etest->flags |= ETH_TEST_FL_FAILED;
+}
+
+static int ccat_eth_get_sset_count(struct net_device *dev, int sset)
+{
+	if (sset == ETH_SS_TEST && ccat_eth_is_dma(netdev_priv(dev)))
+		return CCAT_TEST_COUNT;
+	return -EOPNOTSUPP;
+}
+
+static void ccat_eth_get_strings(struct net_device *dev, u32 stringset,
+				 u8 * data)
+{
+	if (stringset == ETH_SS_TEST)
+		memcpy(data, ccat_eth_test_names, sizeof(ccat_eth_test_names));
+}
+
+static const struct ethtool_ops ccat_eth_ethtool_ops = {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 7, 0)
+	.supported_coalesce_params = ETHTOOL_COALESCE_RX_MAX_FRAMES,
+#endif
+	.get_link = ethtool_op_get_link,
+	.get_ringparam = ccat_eth_get_ringparam,
+	.set_ringparam = ccat_eth_set_ringparam,
+	.get_coalesce = ccat_eth_get_coalesce,
+	.set_coalesce = ccat_eth_set_coalesce,
+	.self_test = ccat_eth_self_test,
+	.get_sset_count = ccat_eth_get_sset_count,
+	.get_strings = ccat_eth_get_strings,
+};
+
+static struct ccat_eth_priv *ccat_eth_alloc_netdev(struct ccat_function *func)
+{
+	struct ccat_eth_priv *priv = NULL;
+	struct net_device *const netdev =
+	    alloc_etherdev_mq(sizeof(*priv), CCAT_TXQ_COUNT);
+
+	if (netdev) {
+		priv = netdev_priv(netdev);
+		memset(priv, 0, sizeof(*priv));
+		priv->netdev = netdev;
+		priv->func = func;
+		spin_lock_init(&priv->tx_lock);
+		spin_lock_init(&priv->stats_lock);
+		mutex_init(&priv->pi_lock);
+		init_waitqueue_head(&priv->pi_wait);
+		skb_queue_head_init(&priv->txtime_queue);
+		priv->rx_budget = CCAT_NAPI_WEIGHT;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 19, 0)
+		netif_napi_add(netdev, &priv->napi, ccat_eth_napi_poll,
+			       CCAT_NAPI_WEIGHT);
+#else
+		netif_napi_add_weight(netdev, &priv->napi, ccat_eth_napi_poll,
+				      CCAT_NAPI_WEIGHT);
+#endif
+		ccat_eth_priv_init_reg(priv);
+	}
+	return priv;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 15, 0)
+static inline void eth_hw_addr_set(struct net_device *dev, const u8 *addr)
+{
+	memcpy(dev->dev_addr, addr, dev->addr_len);
+}
+#endif
+
+static int ccat_eth_init_netdev(struct ccat_eth_priv *priv)
+{
+	int status;
+
+	/* read MAC from hardware and validate */
+	u8 mac_addr[ETH_ALEN];
+	ccat_memcpy_fromio(mac_addr, priv->reg.mii + 8, sizeof(mac_addr));
+	if (!is_valid_ether_addr(mac_addr)) {
+		pr_err("Invalid MAC address: %pM.\n", mac_addr);
+		return -EADDRNOTAVAIL;
+	}
+
+	/* init netdev with MAC and stack callbacks */
+	eth_hw_addr_set(priv->netdev, mac_addr);
+	priv->netdev->netdev_ops = &ccat_eth_netdev_ops;
+	priv->netdev->ethtool_ops = &ccat_eth_ethtool_ops;
+	if (ccat_eth_is_dma(priv))
+		priv->netdev->hw_features |= NETIF_F_LOOPBACK;
+	netif_carrier_off(priv->netdev);
+	ccat_flight_init(priv);
+
+	status = register_netdev(priv->netdev);
+	if (status) {
+		pr_info("unable to register network device.\n");
+		ccat_eth_priv_free(priv);
+		free_netdev(priv->netdev);
+		return status;
+	}
+	pr_info("registered %s as network device.\n", priv->netdev->name);
+	priv->func->private_data = priv;
+	return 0;
+}
+
+#define CCAT_COPY_ROUNDS 128
+
+/**
+ * Measure a copy kernel with small EtherCAT frames and full size ethernet
+ * frames alternating.
+ * @return throughput in bytes/s
+ */
+static u64 ccat_copy_measure(const enum ccat_copy_id id, void *dst,
+			     const void *src)
+{
+	static const size_t sizes[] = { 64, ETH_FRAME_LEN };
+	u64 bytes = 0;
+	u64 start, ns;
+	size_t i, n;
+
+	preempt_disable();
+	/* warm up caches and the branch predictor */
+	for (i = 0; i < ARRAY_SIZE(sizes); ++i)
+		ccat_copy(id, dst, src, sizes[i]);
+
+	start = ktime_get_ns();
+	for (n = 0; n < CCAT_COPY_ROUNDS; ++n) {
+		for (i = 0; i < ARRAY_SIZE(sizes); ++i) {
+			ccat_copy(id, dst, src, sizes[i]);
+			bytes += sizes[i];
+		}
+	}
+	ns = ktime_get_ns() - start;
+	preempt_enable();
+	return div64_u64(bytes * NSEC_PER_SEC, max_t(u64, ns, 1));
+}
+
+/**
+ * Pick the fastest copy kernel for each direction, measured between a
+ * kmalloc()ed buffer, like skb data, and the first slot of each DMA fifo.
+ * The slots are not in use by CCAT, yet.
+ */
+static void ccat_eth_copy_calibrate(struct ccat_eth_priv *const priv)
+{
+	void *const buf = kmalloc(sizeof(struct ccat_eth_frame), GFP_KERNEL);
+	struct ccat_eth_fifo *const fifos[CCAT_COPY_DIRS] = {
+		[CCAT_COPY_RX] = &priv->rx_fifo,
+		[CCAT_COPY_TX] = &priv->tx_fifo,
+	};
+	enum ccat_copy_dir dir;
+	enum ccat_copy_id id;
+
+	if (!buf)
+		return;
+
+	memset(buf, 0, sizeof(struct ccat_eth_frame));
+	for (dir = 0; dir < CCAT_COPY_DIRS; ++dir) {
+		u8 *const slot = fifos[dir]->dma.start->data;
+		u64 *const rate = priv->copy_rate[dir];
+
+		for (id = 0; id < CCAT_COPY_COUNT; ++id) {
+			if (!ccat_copy_supported(id, dir))
+				continue;
+			if (dir == CCAT_COPY_RX)
+				rate[id] = ccat_copy_measure(id, buf, slot);
+			else
+				rate[id] = ccat_copy_measure(id, slot, buf);
+			if (rate[id] > rate[fifos[dir]->copy])
+				fifos[dir]->copy = id;
+		}
+	}
+	kfree(buf);
+}
+
+static struct dentry *ccat_eth_debugfs;
+
+static int ccat_eth_copy_show(struct seq_file *s, void *unused)
+{
+	static const char *const dirs[CCAT_COPY_DIRS] = { "rx", "tx" };
+	const struct ccat_eth_priv *const priv = s->private;
+	const struct ccat_eth_fifo *const fifos[CCAT_COPY_DIRS] = {
+		[CCAT_COPY_RX] = &priv->rx_fifo,
+		[CCAT_COPY_TX] = &priv->tx_fifo,
+	};
+	enum ccat_copy_dir dir;
+	enum ccat_copy_id id;
+
+	for (dir = 0; dir < CCAT_COPY_DIRS; ++dir) {
+		for (id = 0; id < CCAT_COPY_COUNT; ++id) {
+			if (!priv->copy_rate[dir][id])
+				continue;
+			seq_printf(s, "%s %-10s %6llu MB/s%s\n", dirs[dir],
+				   ccat_copy_names[id],
+				   div_u64(priv->copy_rate[dir][id], 1000000),
+				   fifos[dir]->copy == id ? " *" : "");
+		}
+	}
+	return 0;
+}
+
+static int ccat_eth_copy_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ccat_eth_copy_show, inode->i_private);
+}
+
+static const struct file_operations ccat_eth_copy_fops = {
+	.owner = THIS_MODULE,
+	.open = ccat_eth_copy_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * Copy the valid records of a flight recorder ring, oldest first, while
+ * the producer keeps going. Records overwritten during the copy are lost.
+ * @return number of records copied to snap
+ */
+static u32 ccat_flight_snapshot(const struct ccat_flight *const fl,
+				struct ccat_flight_rec *const snap)
+{
+	const u32 head = smp_load_acquire(&fl->head);
+	u32 pos = head - min(head, fl->mask + 1);
+	u32 n = 0;
+
+	for (; pos != head; ++pos) {
+		const struct ccat_flight_rec *const rec =
+		    &fl->rec[pos & fl->mask];
+		u32 hw_seq;
+
+		if (smp_load_acquire(&rec->seq) != pos + 1)
+			continue;
+		hw_seq = smp_load_acquire(&rec->hw_seq);
+		memcpy(&snap[n], rec, sizeof(*rec));
+		smp_rmb();
+		if (READ_ONCE(rec->seq) != pos + 1)
+			continue;
+		if (hw_seq != pos + 1 || READ_ONCE(rec->hw_seq) != hw_seq)
+			snap[n].hw_ns = 0;
+		++n;
+	}
+	return n;
+}
+
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET 1
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_IF_NAME 2
+#define PCAPNG_IF_TSRESOL 9
+#define PCAPNG_EPB_FLAGS 2
+#define PCAPNG_EPB_INBOUND 0x1
+#define PCAPNG_EPB_OUTBOUND 0x2
+
+/**
+ * Worst case size of a flight record in pcapng: block header, packet
+ * header, data, flags, comment, end of options and block trailer.
+ */
+#define CCAT_FLIGHT_PCAPNG_REC (8 + 20 + CCAT_FLIGHT_SNAPLEN + 8 + 4 + 64 + 4 + 4)
+#define CCAT_FLIGHT_PCAPNG_HDR 256
+
+/**
+ * struct ccat_pcapng - pcapng file created on open of flight.pcapng
+ * @len: number of bytes in buf
+ * @buf: the file, in host byte order
+ */
+struct ccat_pcapng {
+	size_t len;
+	u8 buf[];
+};
+
+static void ccat_pcapng_put(struct ccat_pcapng *const p,
+			    const void *const data, const size_t len)
+{
+	memcpy(p->buf + p->len, data, len);
+	memset(p->buf + p->len + len, 0, ALIGN(len, 4) - len);
+	p->len += ALIGN(len, 4);
+}
+
+static void ccat_pcapng_u32(struct ccat_pcapng *const p, const u32 value)
+{
+	ccat_pcapng_put(p, &value, sizeof(value));
+}
+
+static void ccat_pcapng_opt(struct ccat_pcapng *const p, const u16 code,
+			    const void *const data, const u16 len)
+{
+	const u16 opt[2] = { code, len };
+
+	ccat_pcapng_put(p, opt, sizeof(opt));
+	ccat_pcapng_put(p, data, len);
+}
+
+/**
+ * Start a block, it is completed by ccat_pcapng_end()
+ * @return offset of the block
+ */
+static size_t ccat_pcapng_begin(struct ccat_pcapng *const p, const u32 type)
+{
+	const size_t start = p->len;
+
+	ccat_pcapng_u32(p, type);
+	ccat_pcapng_u32(p, 0);
+	return start;
+}
+
+static void ccat_pcapng_end(struct ccat_pcapng *const p, const size_t start)
+{
+	const u32 total = p->len + sizeof(total) - start;
+
+	memcpy(p->buf + start + sizeof(u32), &total, sizeof(total));
+	ccat_pcapng_u32(p, total);
+}
 
-	ccat_eth_fifo_reset(&priv->rx_fifo);
-	ccat_eth_fifo_reset(&priv->tx_fifo);
+static void ccat_pcapng_header(struct ccat_pcapng *const p,
+			       const struct net_device *const dev)
+{
+	static const u8 tsresol = 9;	/* ns */
+	const struct {
+		u32 magic;
+		u16 major;
+		u16 minor;
+		s64 section_len;
+	} shb = { PCAPNG_BYTE_ORDER_MAGIC, 1, 0, -1 };
+	const struct {
+		u16 linktype;
+		u16 reserved;
+		u32 snaplen;
+	} idb = { PCAPNG_LINKTYPE_ETHERNET, 0, CCAT_FLIGHT_SNAPLEN };
+	size_t start;
 
-	/* TODO reset CCAT MAC register */
+	start = ccat_pcapng_begin(p, PCAPNG_SHB);
+	ccat_pcapng_put(p, &shb, sizeof(shb));
+	ccat_pcapng_end(p, start);
 
-	ccat_eth_xmit_raw(dev, frameForwardEthernetFrames,
-			  sizeof(frameForwardEthernetFrames));
-	netif_carrier_on(dev);
-	netif_start_queue(dev);
+	start = ccat_pcapng_begin(p, PCAPNG_IDB);
+	ccat_pcapng_put(p, &idb, sizeof(idb));
+	ccat_pcapng_opt(p, PCAPNG_IF_NAME, dev->name, strlen(dev->name));
+	ccat_pcapng_opt(p, PCAPNG_IF_TSRESOL, &tsresol, sizeof(tsresol));
+	ccat_pcapng_opt(p, PCAPNG_OPT_END, NULL, 0);
+	ccat_pcapng_end(p, start);
 }
 
 /**
- * Read link state from CCAT hardware
- * @return 1 if link is up, 0 if not
+ * Add a record as enhanced packet block. The fifo slot and the CCAT
+ * timestamp are stored in the comment, as pcapng has no fields for them.
  */
-inline static size_t ccat_eth_priv_read_link_state(const struct ccat_eth_priv
-						   *const priv)
+static void ccat_pcapng_epb(struct ccat_pcapng *const p,
+			    const struct ccat_flight_rec *const rec,
+			    const enum ccat_flight_dir dir)
 {
-	return ! !(ioread32(priv->reg.mii + 0x8 + 4) & (1 << 24));
+	const u32 flags =
+	    (dir == CCAT_FLIGHT_RX) ? PCAPNG_EPB_INBOUND : PCAPNG_EPB_OUTBOUND;
+	const u32 caplen = min_t(u32, rec->len, CCAT_FLIGHT_SNAPLEN);
+	const u32 epb[] = {
+		0,		/* interface id */
+		upper_32_bits(rec->host_ns),
+		lower_32_bits(rec->host_ns),
+		caplen,
+		rec->len,
+	};
+	char comment[64];
+	size_t start;
+	int len;
+
+	if (rec->hw_ns)
+		len = scnprintf(comment, sizeof(comment),
+				"slot %u ccat %llu", rec->slot, rec->hw_ns);
+	else
+		len = scnprintf(comment, sizeof(comment), "slot %u",
+				rec->slot);
+
+	start = ccat_pcapng_begin(p, PCAPNG_EPB);
+	ccat_pcapng_put(p, epb, sizeof(epb));
+	ccat_pcapng_put(p, rec->data, caplen);
+	ccat_pcapng_opt(p, PCAPNG_EPB_FLAGS, &flags, sizeof(flags));
+	ccat_pcapng_opt(p, PCAPNG_OPT_COMMENT, comment, len);
+	ccat_pcapng_opt(p, PCAPNG_OPT_END, NULL, 0);
+	ccat_pcapng_end(p, start);
 }
 
 /**
- * Poll for link state changes
+ * Snapshot both flight recorder rings and merge them by host timestamp
+ * into a pcapng file, which is read from the file.
  */
-static void poll_link(struct ccat_eth_priv *const priv)
+static int ccat_flight_open(struct inode *inode, struct file *file)
 {
-	const size_t link = ccat_eth_priv_read_link_state(priv);
+	struct ccat_eth_priv *const priv = inode->i_private;
+	const u32 records = priv->flight[CCAT_FLIGHT_RX].mask + 1;
+	struct ccat_flight_rec *snap[CCAT_FLIGHT_DIRS] = { NULL, NULL };
+	u32 n[CCAT_FLIGHT_DIRS], i[CCAT_FLIGHT_DIRS] = { 0, 0 };
+	struct ccat_pcapng *p;
+	int dir, status = -ENOMEM;
 
-	if (link != netif_carrier_ok(priv->netdev)) {
-		if (link)
-			ccat_eth_link_up(priv->netdev);
+	p = vmalloc(sizeof(*p) + CCAT_FLIGHT_PCAPNG_HDR +
+		    CCAT_FLIGHT_DIRS * records * CCAT_FLIGHT_PCAPNG_REC);
+	if (!p)
+		return -ENOMEM;
+	p->len = 0;
+
+	for (dir = 0; dir < CCAT_FLIGHT_DIRS; ++dir) {
+		snap[dir] = vmalloc(records * sizeof(struct ccat_flight_rec));
+		if (!snap[dir])
+			goto cleanup;
+		n[dir] = ccat_flight_snapshot(&priv->flight[dir], snap[dir]);
+	}
+
+	ccat_pcapng_header(p, priv->netdev);
+	while (i[CCAT_FLIGHT_RX] < n[CCAT_FLIGHT_RX]
+	       || i[CCAT_FLIGHT_TX] < n[CCAT_FLIGHT_TX]) {
+		if (i[CCAT_FLIGHT_TX] == n[CCAT_FLIGHT_TX])
+			dir = CCAT_FLIGHT_RX;
+		else if (i[CCAT_FLIGHT_RX] == n[CCAT_FLIGHT_RX])
+			dir = CCAT_FLIGHT_TX;
+		else if (snap[CCAT_FLIGHT_RX][i[CCAT_FLIGHT_RX]].host_ns <=
+			 snap[CCAT_FLIGHT_TX][i[CCAT_FLIGHT_TX]].host_ns)
+			dir = CCAT_FLIGHT_RX;
 		else
-			ccat_eth_link_down(priv->netdev);
+			dir = CCAT_FLIGHT_TX;
+		ccat_pcapng_epb(p, &snap[dir][i[dir]++], dir);
 	}
+	file->private_data = p;
+	p = NULL;
+	status = 0;
+cleanup:
+	for (dir = 0; dir < CCAT_FLIGHT_DIRS; ++dir)
+		vfree(snap[dir]);
+	vfree(p);
+	return status;
+}
+
+static ssize_t ccat_flight_read(struct file *file, char __user * buf,
+				size_t count, loff_t * ppos)
+{
+	const struct ccat_pcapng *const p = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, p->buf, p->len);
+}
+
+static int ccat_flight_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations ccat_flight_fops = {
+	.owner = THIS_MODULE,
+	.open = ccat_flight_open,
+	.read = ccat_flight_read,
+	.llseek = default_llseek,
+	.release = ccat_flight_release,
+};
+
+static void ccat_flight_debugfs(struct ccat_eth_priv *const priv)
+{
+	if (priv->flight[CCAT_FLIGHT_RX].rec)
+		debugfs_create_file("flight.pcapng", 0400, priv->debugfs,
+				    priv, &ccat_flight_fops);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0)
+#define EPOLLIN POLLIN
+#define EPOLLRDNORM POLLRDNORM
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
+typedef unsigned int __poll_t;
+#endif
+
+/* woken by every release of a process image cdev, see ccat_eth_cdev_claim() */
+static DECLARE_WAIT_QUEUE_HEAD(ccat_eth_cdev_wait);
+
+static struct ccat_eth_priv *ccat_eth_cdev_priv(struct file *const f)
+{
+	const struct cdev_buffer *const buffer = f->private_data;
+
+	return buffer->ccdev->private_data;
 }
 
 /**
- * Poll for available rx dma descriptors in ethernet operating mode
+ * Each open file remembers the last completion count it returned
  */
-static void poll_rx(struct ccat_eth_priv *const priv)
+static u64 *ccat_eth_cdev_seen(struct file *const f)
 {
-	struct ccat_eth_fifo *const fifo = &priv->rx_fifo;
-	size_t rx_per_poll = FIFO_LENGTH / 2;
-	size_t len = fifo->ops->ready(fifo);
+	struct cdev_buffer *const buffer = f->private_data;
+
+	return (u64 *) buffer->data;
+}
+
+static int ccat_eth_cdev_pi_alloc(struct ccat_eth_priv *const priv,
+				  const u32 size)
+{
+	if (!size || size > CCAT_ETH_PI_MAX_SIZE)
+		return -EINVAL;
+	if (priv->pi_image)
+		return -EBUSY;
+
+	priv->pi_image = vmalloc_user(PAGE_ALIGN(size));
+	if (!priv->pi_image)
+		return -ENOMEM;
+	priv->pi_size = size;
+	return 0;
+}
+
+static int ccat_pi_map_cmp(const void *a, const void *b)
+{
+	const struct ccat_eth_pi_map *const lhs = a;
+	const struct ccat_eth_pi_map *const rhs = b;
+
+	return (int)lhs->frame_index - (int)rhs->frame_index;
+}
+
+static int ccat_eth_cdev_pi_map(struct ccat_eth_priv *const priv,
+				const struct ccat_eth_pi_table *const table)
+{
+	struct ccat_pi *pi = NULL;
+	struct ccat_pi *old;
+	u32 i;
+
+	if (table->reserved || table->count > CCAT_ETH_PI_MAX_MAPS)
+		return -EINVAL;
+
+	if (table->count) {
+		if (!priv->pi_image)
+			return -EINVAL;
+
+		pi = kzalloc(sizeof(*pi) + table->count * sizeof(pi->map[0]),
+			     GFP_KERNEL);
+		if (!pi)
+			return -ENOMEM;
+
+		if (copy_from_user(pi->map, u64_to_user_ptr(table->maps),
+				   table->count * sizeof(pi->map[0]))) {
+			kfree(pi);
+			return -EFAULT;
+		}
 
-	while (len && --rx_per_poll) {
-		ccat_eth_receive(priv, len);
-		fifo->ops->add(fifo);
-		ccat_eth_fifo_inc(fifo);
-		len = fifo->ops->ready(fifo);
+		for (i = 0; i < table->count; ++i) {
+			const struct ccat_eth_pi_map *const map = &pi->map[i];
+
+			if (map->reserved || map->reserved2
+			    || map->length > CCAT_DGRAM_LEN_MASK
+			    || map->pi_offset > priv->pi_size
+			    || map->length > priv->pi_size - map->pi_offset
+			    || priv->pi_size < CCAT_DGRAM_WKC_LEN
+			    || map->wkc_offset > priv->pi_size - CCAT_DGRAM_WKC_LEN) {
+				kfree(pi);
+				return -EINVAL;
+			}
+		}
+
+		sort(pi->map, table->count, sizeof(pi->map[0]), ccat_pi_map_cmp,
+		     NULL);
+		for (i = 0; i < table->count; ++i)
+			++pi->first[pi->map[i].frame_index + 1];
+		for (i = 1; i < ARRAY_SIZE(pi->first); ++i)
+			pi->first[i] += pi->first[i - 1];
+		pi->image = priv->pi_image;
+		pi->size = priv->pi_size;
 	}
+
+	old = rcu_dereference_protected(priv->pi,
+					lockdep_is_held(&priv->pi_lock));
+	rcu_assign_pointer(priv->pi, pi);
+	if (old)
+		kfree_rcu(old, rcu);
+	return 0;
 }
 
+#ifdef CCAT_ETH_URING
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0)
+#define ccat_uring_sqe_cmd(cmd) ((cmd)->cmd)
+#else
+#define ccat_uring_sqe_cmd(cmd) io_uring_sqe_cmd((cmd)->sqe)
+#endif
+
 /**
- * Poll for available tx dma descriptors in ethernet operating mode
+ * Get the io_uring state of the cdev, allocated by the first command. The
+ * state lives until the file is released, which io_uring delays until
+ * all commands completed.
  */
-static void poll_tx(struct ccat_eth_priv *const priv)
+static struct ccat_eth_uring *ccat_eth_uring_get(struct ccat_eth_priv *const
+						 priv,
+						 const unsigned int issue_flags)
 {
-	if (priv->tx_fifo.ops->ready(&priv->tx_fifo)) {
-		netif_wake_queue(priv->netdev);
+	struct ccat_eth_uring *u = rcu_dereference_raw(priv->uring);
+
+	if (u)
+		return u;
+
+	/* io_uring retries from a worker, which may sleep */
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		return ERR_PTR(-EAGAIN);
+
+	mutex_lock(&priv->pi_lock);
+	u = rcu_dereference_protected(priv->uring,
+				      lockdep_is_held(&priv->pi_lock));
+	if (!u) {
+		u = vzalloc_node(sizeof(*u), dev_to_node(priv->func->ccat->dev));
+		if (u) {
+			spin_lock_init(&u->lock);
+			INIT_LIST_HEAD(&u->tx_pending);
+			mutex_init(&u->tx_mutex);
+			rcu_assign_pointer(priv->uring, u);
+		}
 	}
+	mutex_unlock(&priv->pi_lock);
+	return u ? u : ERR_PTR(-ENOMEM);
 }
 
 /**
- * Since CCAT doesn't support interrupts until now, we have to poll
- * some status bits to recognize things like link change etc.
+ * Queue all frames of a SEND command into the tx fifo, or none. The
+ * command completes in ccat_eth_uring_tx_done().
  */
-static enum hrtimer_restart poll_timer_callback(struct hrtimer *timer)
+static int ccat_eth_uring_send(struct ccat_eth_priv *const priv,
+			       struct ccat_eth_uring *const u,
+			       struct io_uring_cmd *const cmd,
+			       const struct ccat_eth_uring_cmd *const req,
+			       const unsigned int issue_flags)
 {
-	struct ccat_eth_priv *const priv =
-	    container_of(timer, struct ccat_eth_priv, poll_timer);
+	struct ccat_eth_uring_pdu *const pdu = ccat_uring_pdu(cmd);
+	struct ccat_eth_fifo *const fifo = &priv->tx_fifo;
+	struct ccat_eth_uring_frame frames[CCAT_ETH_URING_MAX_FRAMES];
+	unsigned long flags;
+	int status = 0;
+	u32 i;
 
-	poll_link(priv);
-	poll_rx(priv);
-	poll_tx(priv);
-	hrtimer_forward_now(timer, POLL_TIME);
-	return HRTIMER_RESTART;
+	if (copy_from_user(frames, u64_to_user_ptr(req->frames),
+			   req->count * sizeof(frames[0])))
+		return -EFAULT;
+	for (i = 0; i < req->count; ++i) {
+		if (frames[i].reserved || frames[i].len < ETH_HLEN
+		    || frames[i].len > ETH_FRAME_LEN)
+			return -EINVAL;
+	}
+
+	if (issue_flags & IO_URING_F_NONBLOCK) {
+		if (!mutex_trylock(&u->tx_mutex))
+			return -EAGAIN;
+	} else {
+		mutex_lock(&u->tx_mutex);
+	}
+	for (i = 0; i < req->count && !status; ++i) {
+		if (copy_from_user(u->tx_buf[i], u64_to_user_ptr(frames[i].addr),
+				   frames[i].len))
+			status = -EFAULT;
+	}
+	if (status) {
+		mutex_unlock(&u->tx_mutex);
+		return status;
+	}
+
+	ccat_uring_mark_cancelable(cmd, issue_flags);
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	if (!netif_carrier_ok(priv->netdev)) {
+		status = -ENETDOWN;
+	} else if (ccat_eth_tx_space(fifo) < req->count) {
+		status = -ENOBUFS;
+	} else {
+		for (i = 0; i < req->count; ++i) {
+			fifo_dma_queue_frame(fifo, u->tx_buf[i], frames[i].len);
+			ccat_flight_tx(priv, u->tx_buf[i], frames[i].len,
+				       fifo->head);
+			atomic64_add(frames[i].len, &fifo->bytes);
+			/* publish the frame to poll_tx() */
+			smp_store_release(&fifo->head, fifo->head + 1);
+		}
+		pdu->count = req->count;
+		pdu->end = fifo->head;
+		/* added under tx_lock, so tx_pending stays in fifo order */
+		spin_lock(&u->lock);
+		list_add_tail(&pdu->node, &u->tx_pending);
+		spin_unlock(&u->lock);
+		ccat_eth_tx_throttle(priv, &dma_tx_fifo_ops);
+	}
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+	mutex_unlock(&u->tx_mutex);
+
+	if (status) {
+		/* the command is marked cancelable, so it has to be done */
+		ccat_uring_done(cmd, status, issue_flags);
+	} else {
+		ccat_eth_xmit_reap(priv, &dma_rx_fifo_ops);
+	}
+	return -EIOCBQUEUED;
 }
 
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0))
-static struct rtnl_link_stats64 *ccat_eth_get_stats64(struct net_device *dev, struct rtnl_link_stats64
-						      *storage)
-#else
-static void ccat_eth_get_stats64(struct net_device *dev,
-				 struct rtnl_link_stats64 *storage)
-#endif
+/**
+ * Wait for received frames, the command completes in ccat_uring_task()
+ */
+static int ccat_eth_uring_recv(struct ccat_eth_priv *const priv,
+			       struct ccat_eth_uring *const u,
+			       struct io_uring_cmd *const cmd,
+			       const struct ccat_eth_uring_cmd *const req,
+			       const unsigned int issue_flags)
 {
-	struct ccat_eth_priv *const priv = netdev_priv(dev);
-	struct ccat_mac_register mac;
-
-	memcpy_fromio(&mac, priv->reg.mac, sizeof(mac));
-	storage->rx_packets = mac.rx_frames;	/* total packets received       */
-	storage->tx_packets = mac.tx_frames;	/* total packets transmitted    */
-	storage->rx_bytes = atomic64_read(&priv->rx_fifo.bytes);	/* total bytes received         */
-	storage->tx_bytes = atomic64_read(&priv->tx_fifo.bytes);	/* total bytes transmitted      */
-	storage->rx_errors = mac.frame_len_err + mac.rx_mem_full + mac.crc_err + mac.rx_err;	/* bad packets received         */
-	storage->tx_errors = mac.tx_mem_full;	/* packet transmit problems     */
-	storage->rx_dropped = atomic64_read(&priv->rx_fifo.dropped);	/* no space in linux buffers    */
-	storage->tx_dropped = atomic64_read(&priv->tx_fifo.dropped);	/* no space available in linux  */
-	//TODO __u64    multicast;              /* multicast packets received   */
-	//TODO __u64    collisions;
+	struct ccat_eth_uring_pdu *const pdu = ccat_uring_pdu(cmd);
 
-	/* detailed rx_errors: */
-	storage->rx_length_errors = mac.frame_len_err;
-	storage->rx_over_errors = mac.rx_mem_full;	/* receiver ring buff overflow  */
-	storage->rx_crc_errors = mac.crc_err;	/* recved pkt with crc error    */
-	storage->rx_frame_errors = mac.rx_err;	/* recv'd frame alignment error */
-	storage->rx_fifo_errors = mac.rx_mem_full;	/* recv'r fifo overrun          */
-	//TODO __u64    rx_missed_errors;       /* receiver missed packet       */
+	if (!READ_ONCE(priv->uring_rx))
+		return -EINVAL;
+	if (test_and_set_bit_lock(0, &u->rx_busy))
+		return -EBUSY;
 
-	/* detailed tx_errors */
-	//TODO __u64    tx_aborted_errors;
-	//TODO __u64    tx_carrier_errors;
-	//TODO __u64    tx_fifo_errors;
-	//TODO __u64    tx_heartbeat_errors;
-	//TODO __u64    tx_window_errors;
+	pdu->uring = u;
+	pdu->frames = req->frames;
+	pdu->count = req->count;
+	ccat_uring_mark_cancelable(cmd, issue_flags);
 
-	/* for cslip etc */
-	//TODO __u64    rx_compressed;
-	//TODO __u64    tx_compressed;
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0))
-	return storage;
-#endif
+	/* either napi sees rx_pending or we see its frames */
+	spin_lock_bh(&u->lock);
+	u->rx_pending = cmd;
+	if (!READ_ONCE(priv->uring_rx)) {
+		/* switched off since the test above */
+		u->rx_pending = NULL;
+		ccat_uring_complete(cmd, -ECANCELED);
+	} else if (smp_load_acquire(&u->rx_head) != u->rx_tail) {
+		u->rx_pending = NULL;
+		ccat_uring_complete(cmd, 0);
+	}
+	spin_unlock_bh(&u->lock);
+	return -EIOCBQUEUED;
 }
 
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(6,13,0))
-static void hrtimer_setup(struct hrtimer *timer, enum hrtimer_restart (*function)(struct hrtimer *), clockid_t clock_id, enum hrtimer_mode mode)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+/**
+ * Complete a pending command with -ECANCELED. The frames of a canceled
+ * SEND command are still sent.
+ */
+static int ccat_eth_uring_cancel(struct ccat_eth_priv *const priv,
+				 struct io_uring_cmd *const cmd,
+				 const unsigned int issue_flags)
 {
-	hrtimer_init(timer, clock_id, mode);
-	timer->function = function;
+	struct ccat_eth_uring *const u = rcu_dereference_raw(priv->uring);
+	struct ccat_eth_uring_pdu *pdu;
+	bool found = false;
+
+	spin_lock_bh(&u->lock);
+	if (u->rx_pending == cmd) {
+		u->rx_pending = NULL;
+		found = true;
+	} else {
+		list_for_each_entry(pdu, &u->tx_pending, node) {
+			if (ccat_uring_cmd(pdu) == cmd) {
+				list_del(&pdu->node);
+				found = true;
+				break;
+			}
+		}
+	}
+	spin_unlock_bh(&u->lock);
+
+	/* not found: napi already handed the command to its task */
+	if (found) {
+		ccat_uring_pdu(cmd)->res = -ECANCELED;
+		__ccat_uring_task(cmd, issue_flags);
+	}
+	return 0;
 }
 #endif
 
-static int ccat_eth_open(struct net_device *dev)
+static int ccat_eth_cdev_uring_cmd(struct io_uring_cmd *cmd,
+				   unsigned int issue_flags)
 {
-	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	struct ccat_eth_priv *const priv = ccat_eth_cdev_priv(cmd->file);
+	const struct ccat_eth_uring_cmd *const sqe = ccat_uring_sqe_cmd(cmd);
+	struct ccat_eth_uring_cmd req;
+	struct ccat_eth_uring *u;
 
-	hrtimer_setup(&priv->poll_timer, poll_timer_callback, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	hrtimer_start(&priv->poll_timer, POLL_TIME, HRTIMER_MODE_REL);
-	return 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	if (issue_flags & IO_URING_F_CANCEL)
+		return ccat_eth_uring_cancel(priv, cmd, issue_flags);
+#endif
+
+	/* the sqe is shared with userspace */
+	req.frames = READ_ONCE(sqe->frames);
+	req.count = READ_ONCE(sqe->count);
+	req.reserved = READ_ONCE(sqe->reserved);
+	if (req.reserved || !req.count || req.count > CCAT_ETH_URING_MAX_FRAMES)
+		return -EINVAL;
+
+	u = ccat_eth_uring_get(priv, issue_flags);
+	if (IS_ERR(u))
+		return PTR_ERR(u);
+
+	switch (cmd->cmd_op) {
+	case CCAT_ETH_URING_SEND:
+		return ccat_eth_uring_send(priv, u, cmd, &req, issue_flags);
+	case CCAT_ETH_URING_RECV:
+		return ccat_eth_uring_recv(priv, u, cmd, &req, issue_flags);
+	default:
+		return -ENOTTY;
+	}
 }
 
-static int ccat_eth_stop(struct net_device *dev)
+/**
+ * Switch the diversion of received EtherCAT frames to RECV, see
+ * CCAT_ETH_IOC_URING_RX.
+ */
+static int ccat_eth_cdev_uring_rx(struct ccat_eth_priv *const priv,
+				  const bool enable)
 {
-	struct ccat_eth_priv *const priv = netdev_priv(dev);
+	struct ccat_eth_uring *const u = ccat_eth_uring_get(priv, 0);
+	struct io_uring_cmd *cmd;
+	int status = 0;
 
-	netif_stop_queue(dev);
-	hrtimer_cancel(&priv->poll_timer);
+	if (IS_ERR(u))
+		return PTR_ERR(u);
+
+	rtnl_lock();
+	if (enable && rtnl_dereference(priv->rx_hook))
+		status = -EBUSY;
+	else
+		WRITE_ONCE(priv->uring_rx, enable);
+	rtnl_unlock();
+	if (status || enable)
+		return status;
+
+	/* ccat_eth_uring_recv() tests uring_rx under the lock again */
+	spin_lock_bh(&u->lock);
+	cmd = u->rx_pending;
+	u->rx_pending = NULL;
+	if (cmd)
+		ccat_uring_complete(cmd, -ECANCELED);
+	spin_unlock_bh(&u->lock);
 	return 0;
 }
+#endif
 
-static const struct net_device_ops ccat_eth_netdev_ops = {
-	.ndo_get_stats64 = ccat_eth_get_stats64,
-	.ndo_open = ccat_eth_open,
-	.ndo_start_xmit = ccat_eth_start_xmit,
-	.ndo_stop = ccat_eth_stop,
-};
+static long ccat_eth_cdev_ioctl(struct file *f, unsigned int cmd,
+				unsigned long arg)
+{
+	struct ccat_eth_priv *const priv = ccat_eth_cdev_priv(f);
+	void __user *const uarg = (void __user *)arg;
+	struct ccat_eth_pi_table table;
+	u32 size;
+	long status;
 
-static struct ccat_eth_priv *ccat_eth_alloc_netdev(struct ccat_function *func)
+	switch (cmd) {
+#ifdef CCAT_ETH_URING
+	case CCAT_ETH_IOC_URING_RX:
+		if (copy_from_user(&size, uarg, sizeof(size)))
+			return -EFAULT;
+		return ccat_eth_cdev_uring_rx(priv, size);
+#endif
+	case CCAT_ETH_IOC_PI_ALLOC:
+		if (copy_from_user(&size, uarg, sizeof(size)))
+			return -EFAULT;
+		mutex_lock(&priv->pi_lock);
+		status = ccat_eth_cdev_pi_alloc(priv, size);
+		mutex_unlock(&priv->pi_lock);
+		return status;
+	case CCAT_ETH_IOC_PI_MAP:
+		if (copy_from_user(&table, uarg, sizeof(table)))
+			return -EFAULT;
+		mutex_lock(&priv->pi_lock);
+		status = ccat_eth_cdev_pi_map(priv, &table);
+		mutex_unlock(&priv->pi_lock);
+		return status;
+	default:
+		return -ENOTTY;
+	}
+}
+
+/**
+ * Returns the number of frames scattered into the process image, blocks
+ * until it changed since the last read.
+ */
+static ssize_t ccat_eth_cdev_read(struct file *const f, char __user * buf,
+				  size_t len, loff_t * off)
 {
-	struct ccat_eth_priv *priv = NULL;
-	struct net_device *const netdev = alloc_etherdev(sizeof(*priv));
+	struct ccat_eth_priv *const priv = ccat_eth_cdev_priv(f);
+	u64 *const seen = ccat_eth_cdev_seen(f);
+	u64 seq;
 
-	if (netdev) {
-		priv = netdev_priv(netdev);
-		memset(priv, 0, sizeof(*priv));
-		priv->netdev = netdev;
-		priv->func = func;
-		ccat_eth_priv_init_reg(priv);
+	if (len < sizeof(seq))
+		return -EINVAL;
+
+	seq = atomic64_read(&priv->pi_seq);
+	if (seq == *seen) {
+		if (f->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(priv->pi_wait,
+					     (seq =
+					      atomic64_read(&priv->pi_seq)) !=
+					     *seen))
+			return -ERESTARTSYS;
 	}
-	return priv;
+	/* pairs with smp_mb__before_atomic() in ccat_eth_pi_scatter() */
+	smp_rmb();
+	*seen = seq;
+	if (copy_to_user(buf, &seq, sizeof(seq)))
+		return -EFAULT;
+	return sizeof(seq);
 }
 
-#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 15, 0)
-static inline void eth_hw_addr_set(struct net_device *dev, const u8 *addr)
+static __poll_t ccat_eth_cdev_poll(struct file *const f,
+				   struct poll_table_struct *wait)
 {
-	memcpy(dev->dev_addr, addr, dev->addr_len);
+	struct ccat_eth_priv *const priv = ccat_eth_cdev_priv(f);
+
+	poll_wait(f, &priv->pi_wait, wait);
+	if (atomic64_read(&priv->pi_seq) != *ccat_eth_cdev_seen(f))
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
 }
-#endif
 
-static int ccat_eth_init_netdev(struct ccat_eth_priv *priv)
+static int ccat_eth_cdev_mmap(struct file *const f, struct vm_area_struct *vma)
 {
-	int status;
+	struct ccat_eth_priv *const priv = ccat_eth_cdev_priv(f);
+	int status = -EINVAL;
 
-	/* read MAC from hardware and validate */
-	u8 mac_addr[ETH_ALEN];
-	memcpy_fromio(mac_addr, priv->reg.mii + 8, sizeof(mac_addr));
-	if (!is_valid_ether_addr(mac_addr)) {
-		pr_err("Invalid MAC address: %pM.\n", mac_addr);
-		return -EADDRNOTAVAIL;
-	}
+	mutex_lock(&priv->pi_lock);
+	if (priv->pi_image)
+		status = remap_vmalloc_range(vma, priv->pi_image, vma->vm_pgoff);
+	mutex_unlock(&priv->pi_lock);
+	return status;
+}
 
-	/* init netdev with MAC and stack callbacks */
-	eth_hw_addr_set(priv->netdev, mac_addr);
-	priv->netdev->netdev_ops = &ccat_eth_netdev_ops;
-	netif_carrier_off(priv->netdev);
+static int ccat_eth_cdev_release(struct inode *const i, struct file *const f)
+{
+	struct ccat_eth_priv *const priv = ccat_eth_cdev_priv(f);
+	struct ccat_pi *pi;
+#ifdef CCAT_ETH_URING
+	struct ccat_eth_uring *u;
 
-	status = register_netdev(priv->netdev);
-	if (status) {
-		pr_info("unable to register network device.\n");
-		ccat_eth_priv_free(priv);
-		free_netdev(priv->netdev);
-		return status;
-	}
-	pr_info("registered %s as network device.\n", priv->netdev->name);
-	priv->func->private_data = priv;
+	/* frames go to the network stack again */
+	rtnl_lock();
+	WRITE_ONCE(priv->uring_rx, false);
+	rtnl_unlock();
+#endif
+
+	mutex_lock(&priv->pi_lock);
+	pi = rcu_dereference_protected(priv->pi,
+				       lockdep_is_held(&priv->pi_lock));
+	RCU_INIT_POINTER(priv->pi, NULL);
+#ifdef CCAT_ETH_URING
+	u = rcu_dereference_protected(priv->uring,
+				      lockdep_is_held(&priv->pi_lock));
+	RCU_INIT_POINTER(priv->uring, NULL);
+#endif
+	/* wait for napi to leave the process image and the io_uring state */
+	synchronize_rcu();
+	kfree(pi);
+#ifdef CCAT_ETH_URING
+	vfree(u);
+#endif
+	vfree(priv->pi_image);
+	priv->pi_image = NULL;
+	priv->pi_size = 0;
+	mutex_unlock(&priv->pi_lock);
+	ccat_cdev_release(i, f);
+	wake_up(&ccat_eth_cdev_wait);
 	return 0;
 }
 
-static int ccat_eth_dma_probe(struct platform_device *pdev)
+/**
+ * Take the only open slot of the process image cdev for ourselves, before
+ * the netdev goes away. The fops of an open file use priv, so remove has
+ * to wait until userspace closed it. Once claimed, new opens fail with
+ * -EBUSY until ccat_cdev_del() removed the device.
+ */
+static void ccat_eth_cdev_claim(struct ccat_eth_priv *const priv)
+{
+	atomic_t *const in_use = &priv->cdev->in_use;
+
+	if (atomic_cmpxchg(in_use, 1, 0) == 1)
+		return;
+
+	netdev_info(priv->netdev, "waiting for the process image to be closed\n");
+	wait_event(ccat_eth_cdev_wait, atomic_cmpxchg(in_use, 1, 0) == 1);
+}
+
+#define CCAT_ETH_DEVICES_MAX 4
+static struct ccat_cdev ccat_eth_cdevs[CCAT_ETH_DEVICES_MAX];
+static struct ccat_class ccat_eth_cdev_class = {
+	.instances = {0},
+	.count = CCAT_ETH_DEVICES_MAX,
+	.devices = ccat_eth_cdevs,
+	.name = "ccat_eth",
+	.fops = {
+		 .owner = THIS_MODULE,
+		 .open = ccat_cdev_open,
+		 .release = ccat_eth_cdev_release,
+		 .read = ccat_eth_cdev_read,
+		 .poll = ccat_eth_cdev_poll,
+		 .mmap = ccat_eth_cdev_mmap,
+		 .unlocked_ioctl = ccat_eth_cdev_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+		 .compat_ioctl = compat_ptr_ioctl,
+#endif
+#ifdef CCAT_ETH_URING
+		 .uring_cmd = ccat_eth_cdev_uring_cmd,
+#endif
+		 },
+};
+
+static long __ccat_eth_dma_probe(void *data)
 {
+	struct platform_device *const pdev = data;
 	struct ccat_function *const func = pdev->dev.platform_data;
 	struct ccat_eth_priv *const priv = ccat_eth_alloc_netdev(func);
 	int status;
@@ -856,14 +4039,54 @@ static int ccat_eth_dma_probe(struct platform_device *pdev)
 		free_netdev(priv->netdev);
 		return status;
 	}
-	return ccat_eth_init_netdev(priv);
+	ccat_eth_copy_calibrate(priv);
+
+	status = ccat_eth_init_netdev(priv);
+	if (status)
+		return status;
+
+	priv->debugfs = debugfs_create_dir(dev_name(&pdev->dev), ccat_eth_debugfs);
+	debugfs_create_file("copy", 0444, priv->debugfs, priv,
+			    &ccat_eth_copy_fops);
+	ccat_flight_debugfs(priv);
+
+	/* the process image cdev is optional, the netdev works without */
+	priv->cdev = ccat_cdev_add(func, &ccat_eth_cdev_class, sizeof(u64), priv);
+	if (!priv->cdev)
+		pr_warn("%s(): no process image device for %s.\n", __FUNCTION__,
+			priv->netdev->name);
+	return 0;
+}
+
+/**
+ * Probe on a CPU local to the CCAT, like the PCI core does for PCI drivers.
+ * The netdev with the fifo state and everything else allocated by the
+ * probe end up on the node of the device, even if ccat_netdev is loaded
+ * later from another node. The DMA memory is node local anyway.
+ */
+static int ccat_eth_dma_probe(struct platform_device *pdev)
+{
+	struct ccat_function *const func = pdev->dev.platform_data;
+	const int cpu = ccat_eth_local_cpu(func);
+
+	if (cpu < 0 || cpu_to_node(cpu) == numa_node_id())
+		return __ccat_eth_dma_probe(pdev);
+	return work_on_cpu(cpu, __ccat_eth_dma_probe, pdev);
 }
 
 static REMOVE_RESULT ccat_eth_dma_remove(struct platform_device *pdev)
 {
 	struct ccat_function *const func = pdev->dev.platform_data;
 	struct ccat_eth_priv *const eth = func->private_data;
+	if (eth->cdev) {
+		ccat_eth_cdev_claim(eth);
+		ccat_cdev_del(eth->cdev);
+	}
+	debugfs_remove_recursive(eth->debugfs);
 	unregister_netdev(eth->netdev);
+	netif_napi_del(&eth->napi);
+	/* napi is gone, no reader of a leftover rx hook */
+	kfree(rcu_dereference_protected(eth->rx_hook, 1));
 	ccat_eth_priv_free(eth);
 	free_netdev(eth->netdev);
 	return REMOVE_OK;
@@ -890,14 +4113,23 @@ static int ccat_eth_eim_probe(struct platform_device *pdev)
 		free_netdev(priv->netdev);
 		return status;
 	}
-	return ccat_eth_init_netdev(priv);
+
+	status = ccat_eth_init_netdev(priv);
+	if (status)
+		return status;
+
+	priv->debugfs = debugfs_create_dir(dev_name(&pdev->dev), ccat_eth_debugfs);
+	ccat_flight_debugfs(priv);
+	return 0;
 }
 
 static REMOVE_RESULT ccat_eth_eim_remove(struct platform_device *pdev)
 {
 	struct ccat_function *const func = pdev->dev.platform_data;
 	struct ccat_eth_priv *const eth = func->private_data;
+	debugfs_remove_recursive(eth->debugfs);
 	unregister_netdev(eth->netdev);
+	netif_napi_del(&eth->napi);
 	ccat_eth_priv_free(eth);
 	free_netdev(eth->netdev);
 	return REMOVE_OK;
@@ -912,17 +4144,25 @@ static struct platform_driver ccat_eth_eim_driver = {
 static int __init ccat_eth_init(void)
 {
 	int result;
+	ccat_eth_debugfs = debugfs_create_dir("ccat_netdev", NULL);
 	result = platform_driver_register(&ccat_eth_eim_driver);
 	if (result != 0) {
+		debugfs_remove_recursive(ccat_eth_debugfs);
 		return result;
 	}
-	return platform_driver_register(&ccat_eth_dma_driver);
+	result = platform_driver_register(&ccat_eth_dma_driver);
+	if (result != 0) {
+		platform_driver_unregister(&ccat_eth_eim_driver);
+		debugfs_remove_recursive(ccat_eth_debugfs);
+	}
+	return result;
 }
 
 static void __exit ccat_eth_exit(void)
 {
 	platform_driver_unregister(&ccat_eth_eim_driver);
 	platform_driver_unregister(&ccat_eth_dma_driver);
+	debugfs_remove_recursive(ccat_eth_debugfs);
 }
 
 module_init(ccat_eth_init);
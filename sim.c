@@ -0,0 +1,618 @@
+// SPDX-License-Identifier: MIT
+/**
+    Network Driver for Beckhoff CCAT communication controller
+    Copyright (C) Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+*/
+
+#include <linux/bitrev.h>
+#include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/etherdevice.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/platform_device.h>
+#include <linux/vmalloc.h>
+#include "module.h"
+
+MODULE_DESCRIPTION("Beckhoff CCAT simulator");
+MODULE_AUTHOR("Patrick Bruenn <p.bruenn@beckhoff.com>");
+MODULE_LICENSE("GPL and additional rights");
+MODULE_VERSION(DRV_VERSION);
+
+/**
+ * ccat_sim registers a CCAT with RAM-backed BARs with the ccat core. The
+ * unmodified function drivers attach to it, while a kernel thread plays
+ * the FPGA part: it consumes the Ethernet DMA tx slots, produces rx frames
+ * (loopback and/or generator), answers EPCS flash commands with realistic
+ * busy times and advances the systemtime counter. GPIO and SRAM are plain
+ * memory.
+ *
+ * Since a RAM-backed BAR can't trap register accesses, the thread polls
+ * every poll_us and spins while the EPCS function is in use. DMA addresses
+ * written by ccat_netdev are translated with phys_to_virt(), which holds
+ * for dma-direct without an IOMMU, like on most x86 machines and VMs.
+ */
+static bool loopback = true;
+module_param(loopback, bool, 0644);
+MODULE_PARM_DESC(loopback, "receive all transmitted frames (default: 1)");
+
+static unsigned int gen_pps;
+module_param(gen_pps, uint, 0644);
+MODULE_PARM_DESC(gen_pps, "frames generated per second on rx (default: 0)");
+
+static unsigned int gen_len = ETH_ZLEN;
+module_param(gen_len, uint, 0644);
+MODULE_PARM_DESC(gen_len, "length of generated frames (default: 60)");
+
+static unsigned int poll_us = 10;
+module_param(poll_us, uint, 0644);
+MODULE_PARM_DESC(poll_us, "simulator poll period in microseconds (default: 10)");
+
+static unsigned int erase_ms = 1000;
+module_param(erase_ms, uint, 0644);
+MODULE_PARM_DESC(erase_ms, "EPCS bulk erase time in milliseconds (default: 1000)");
+
+/** BAR layout of the simulated CCAT */
+#define SIM_BAR0_SIZE 0x30000
+#define SIM_BAR2_SIZE 0x2000
+#define SIM_ETH_ADDR 0x1000
+#define SIM_ETH_SIZE 0x1000
+#define SIM_GPIO_ADDR 0x2000
+#define SIM_GPIO_SIZE 0x100
+#define SIM_GPIO_COUNT 32
+#define SIM_TIME_ADDR 0x3000
+#define SIM_TIME_SIZE 0x100
+#define SIM_EPCS_ADDR 0x4000
+#define SIM_EPCS_SIZE 0x800
+#define SIM_SRAM_ADDR 0x10000
+#define SIM_SRAM_SIZE_LOG2 17
+#define SIM_CCATINFO 0x1
+#define SIM_FUNCTIONS 6
+
+/** Ethernet function registers, relative to SIM_ETH_ADDR */
+#define SIM_ETH_MII 0x100
+#define SIM_ETH_FIFO 0x200
+#define SIM_ETH_MAC 0x300
+#define SIM_ETH_MISC 0x380
+#define SIM_ETH_RX_MEM 0x400
+#define SIM_ETH_TX_MEM 0x800
+#define SIM_ETH_TX_CHAN 0
+#define SIM_ETH_RX_CHAN 1
+#define SIM_DMA_ADDR(chan) (0x1000 + sizeof(u64) * (chan))
+
+/** see struct ccat_dma_frame in netdev.c */
+#define SIM_DMA_SLOTS 64
+#define SIM_FRAME_DONE 0x1
+struct ccat_sim_frame {
+	__le32 reserved1;
+	__le32 rx_flags;
+	__le16 length;
+	__le16 reserved3;
+	__le32 tx_flags;
+	__le64 timestamp;
+	u8 data[0x800 - 24];
+};
+
+/** EPCS function registers, relative to SIM_EPCS_ADDR, see update.c */
+#define SIM_EPCS_CLOCKS_HI 0x0
+#define SIM_EPCS_BUSY 0x1
+#define SIM_EPCS_CLOCKS_LO 0x8
+#define SIM_EPCS_CMD 0x10
+#define SIM_EPCS_ADDR_2 0x18
+#define SIM_EPCS_ADDR_1 0x20
+#define SIM_EPCS_STATUS 0x20
+#define SIM_EPCS_ADDR_0 0x28
+#define SIM_EPCS_DATA_OUT 0x30
+#define SIM_EPCS_DATA_IN 0x38
+#define SIM_EPCS_ACTIVATE 0x7f8
+#define SIM_EPCS_DATA_MAX ((SIM_EPCS_ACTIVATE - SIM_EPCS_DATA_IN) / 8)
+#define SIM_EPCS_CMD_CLOCKS 32
+
+#define SIM_EPCS_BULK_ERASE 0xE3
+#define SIM_EPCS_GET_PROM_ID 0xD5
+#define SIM_EPCS_READ_FLASH 0xC0
+#define SIM_EPCS_READ_STATUS 0xA0
+#define SIM_EPCS_WRITE_ENABLE 0x60
+#define SIM_EPCS_WRITE_FLASH 0x40
+
+#define SIM_EPCS_FLASH_SIZE 0x100000
+#define SIM_EPCS_PROM_ID 0x14
+#define SIM_EPCS_STATUS_WIP 0x80
+/* 20 MHz serial clock and EPCS16 page program time */
+#define SIM_EPCS_NS_PER_CLOCK 50
+#define SIM_EPCS_PROGRAM_NS (1500 * NSEC_PER_USEC)
+#define SIM_EPCS_ACTIVE_NS (10 * NSEC_PER_MSEC)
+
+/**
+ * struct ccat_sim_epcs - state of the simulated EPCS flash
+ * @flash: flash content
+ * @write_enabled: write enable latch
+ * @running: a command is being shifted out until done
+ * @done: time the running command completes
+ * @ready: time the last program or erase completes (status WIP)
+ * @active_until: spin until then, the next command is expected soon
+ */
+struct ccat_sim_epcs {
+	u8 *flash;
+	bool write_enabled;
+	bool running;
+	u64 done;
+	u64 ready;
+	u64 active_until;
+};
+
+/**
+ * struct ccat_sim - simulated CCAT
+ * @pdev: parent device of the CCAT functions, used for DMA allocations
+ * @ccat: the CCAT registered with the ccat core
+ * @bar_0: function registers and memories
+ * @bar_2: DMA channel configuration
+ * @thread: plays the FPGA
+ * @nb: tracks the binding of the Ethernet function driver
+ * @eth_lock: keeps the DMA memory alive while the thread accesses it
+ * @eth_bound: ccat_netdev owns the Ethernet function and its DMA memory
+ * @tx_next: next tx slot to send
+ * @rx_next: next rx slot to fill
+ * @gen_next: time of the next generated frame
+ * @gen_seq: sequence number of the next generated frame
+ * @epcs: EPCS flash state
+ */
+struct ccat_sim {
+	struct platform_device *pdev;
+	struct ccat_device ccat;
+	u8 *bar_0;
+	u8 *bar_2;
+	struct task_struct *thread;
+	struct notifier_block nb;
+	struct mutex eth_lock;
+	bool eth_bound;
+	u32 tx_next;
+	u32 rx_next;
+	u64 gen_next;
+	u32 gen_seq;
+	struct ccat_sim_epcs epcs;
+};
+
+static struct ccat_sim *ccat_sim;
+
+static void ccat_sim_info(struct ccat_sim *const sim, const unsigned int n,
+			  const u16 type, const u32 config, const u32 addr,
+			  const u32 size)
+{
+	struct ccat_info_block *const info =
+	    (struct ccat_info_block *)(sim->bar_0 + n * sizeof(*info));
+
+	info->type = type;
+	info->rev = 0;
+	info->config = config;
+	info->addr = addr;
+	info->size = size;
+}
+
+static u8 *ccat_sim_eth_reg(struct ccat_sim *const sim, const u32 offset)
+{
+	return sim->bar_0 + SIM_ETH_ADDR + offset;
+}
+
+/**
+ * Fill BAR0 with the information blocks parsed by ccat_functions_init()
+ * and the static registers of the functions.
+ */
+static void ccat_sim_build(struct ccat_sim *const sim)
+{
+	static const u32 offsets[] = {
+		0, SIM_ETH_MII, SIM_ETH_FIFO, SIM_ETH_MAC, SIM_ETH_RX_MEM,
+		SIM_ETH_TX_MEM, SIM_ETH_MISC
+	};
+	u8 *const mii = ccat_sim_eth_reg(sim, SIM_ETH_MII);
+
+	/* number of blocks and build date 2014-01-01 */
+	ccat_sim_info(sim, 0, SIM_CCATINFO,
+		      SIM_FUNCTIONS | (1 << 8) | (1 << 16) | (14 << 24), 0, 0);
+	ccat_sim_info(sim, 1, CCATINFO_ETHERCAT_MASTER_DMA,
+		      SIM_ETH_TX_CHAN | (SIM_ETH_RX_CHAN << 8), SIM_ETH_ADDR,
+		      SIM_ETH_SIZE);
+	ccat_sim_info(sim, 2, CCATINFO_GPIO, SIM_GPIO_COUNT, SIM_GPIO_ADDR,
+		      SIM_GPIO_SIZE);
+	ccat_sim_info(sim, 3, CCATINFO_SYSTEMTIME, 0, SIM_TIME_ADDR,
+		      SIM_TIME_SIZE);
+	ccat_sim_info(sim, 4, CCATINFO_EPCS_PROM, 0, SIM_EPCS_ADDR,
+		      SIM_EPCS_SIZE);
+	ccat_sim_info(sim, 5, CCATINFO_SRAM, 1 | (SIM_SRAM_SIZE_LOG2 << 8),
+		      SIM_SRAM_ADDR, 1 << SIM_SRAM_SIZE_LOG2);
+
+	memcpy(ccat_sim_eth_reg(sim, 0), offsets, sizeof(offsets));
+	/* locally administered MAC at mii + 8 and link up */
+	mii[8] = 0x02;
+	mii[13] = 0x01;
+	mii[15] = 0x01;
+
+	/* idle EPCS reports busy, see ccat_sim_epcs() */
+	sim->bar_0[SIM_EPCS_ADDR + SIM_EPCS_BUSY] = 1;
+}
+
+/**
+ * Translate the DMA address ccat_netdev wrote for a channel
+ */
+static struct ccat_sim_frame *ccat_sim_dma(struct ccat_sim *const sim,
+					   const unsigned int chan)
+{
+	const u32 *const reg = (const u32 *)(sim->bar_2 + SIM_DMA_ADDR(chan));
+	/* bit 0 selects 64 bit mode */
+	const phys_addr_t phys =
+	    ((u64) READ_ONCE(reg[1]) << 32) | (READ_ONCE(reg[0]) & ~1U);
+
+	return phys ? phys_to_virt(phys) : NULL;
+}
+
+static bool ccat_sim_eth_receive(struct ccat_sim *const sim,
+				 struct ccat_sim_frame *const rx,
+				 const void *const data, const size_t len,
+				 const u64 now)
+{
+	struct ccat_sim_frame *const frame = &rx[sim->rx_next];
+
+	if (!len || len > sizeof(frame->data))
+		return false;
+
+	/* the slot was not handed back, yet */
+	if (le32_to_cpu(READ_ONCE(frame->rx_flags)) & SIM_FRAME_DONE)
+		return false;
+	smp_mb();
+
+	memcpy(frame->data, data, len);
+	frame->length =
+	    cpu_to_le16(len + offsetof(struct ccat_sim_frame, rx_flags));
+	frame->timestamp = cpu_to_le64(now);
+	smp_wmb();
+	WRITE_ONCE(frame->rx_flags, cpu_to_le32(SIM_FRAME_DONE));
+	sim->rx_next = (sim->rx_next + 1) % SIM_DMA_SLOTS;
+	return true;
+}
+
+/**
+ * Send all tx slots up to the last doorbell. The doorbell register keeps
+ * only the last value written, it is swapped with 0 to detect new writes.
+ */
+static bool ccat_sim_eth_tx(struct ccat_sim *const sim,
+			    struct ccat_sim_frame *const tx,
+			    struct ccat_sim_frame *const rx, const u64 now)
+{
+	u32 *const doorbell = (u32 *) ccat_sim_eth_reg(sim, SIM_ETH_FIFO);
+	const u32 value = xchg(doorbell, 0);
+	u32 last;
+
+	if (!value)
+		return false;
+
+	last = (value & 0xffffff) - offsetof(struct ccat_sim_frame, length);
+	last = (last / sizeof(*tx)) % SIM_DMA_SLOTS;
+	smp_rmb();
+	for (;;) {
+		struct ccat_sim_frame *const frame = &tx[sim->tx_next];
+		const u32 index = sim->tx_next;
+
+		sim->tx_next = (sim->tx_next + 1) % SIM_DMA_SLOTS;
+		if (!(le32_to_cpu(frame->tx_flags) & SIM_FRAME_DONE)) {
+			if (loopback && rx)
+				ccat_sim_eth_receive(sim, rx, frame->data,
+						     le16_to_cpu
+						     (frame->length), now);
+			frame->timestamp = cpu_to_le64(now);
+			smp_wmb();
+			WRITE_ONCE(frame->tx_flags,
+				   cpu_to_le32(SIM_FRAME_DONE));
+		}
+		if (index == last)
+			return true;
+	}
+}
+
+static bool ccat_sim_eth_generate(struct ccat_sim *const sim,
+				  struct ccat_sim_frame *const rx,
+				  const u64 now)
+{
+	const unsigned int pps = READ_ONCE(gen_pps);
+	const size_t len = clamp_t(size_t, READ_ONCE(gen_len), ETH_ZLEN,
+				   ETH_FRAME_LEN);
+	u8 frame[ETH_FRAME_LEN] = { 0 };
+	struct ethhdr *const eth = (struct ethhdr *)frame;
+	unsigned int i;
+
+	if (!pps) {
+		sim->gen_next = 0;
+		return false;
+	}
+	if (!sim->gen_next)
+		sim->gen_next = now;
+
+	eth_broadcast_addr(eth->h_dest);
+	memcpy(eth->h_source, ccat_sim_eth_reg(sim, SIM_ETH_MII + 8), ETH_ALEN);
+	eth->h_source[ETH_ALEN - 1]++;
+	eth->h_proto = htons(ETH_P_802_EX1);
+
+	/* catch up at most one ring per poll */
+	for (i = 0; i < SIM_DMA_SLOTS && sim->gen_next <= now; ++i) {
+		memcpy(eth + 1, &sim->gen_seq, sizeof(sim->gen_seq));
+		if (ccat_sim_eth_receive(sim, rx, frame, len, now))
+			++sim->gen_seq;
+		sim->gen_next += div_u64(NSEC_PER_SEC, pps) ? : 1;
+	}
+	if (sim->gen_next < now)
+		sim->gen_next = now;
+	return i > 0;
+}
+
+/**
+ * ccat_netdev writes 0 to the fifo reset registers, when it restarts both
+ * rings at slot 0. They are armed with ~0 to detect that.
+ */
+static void ccat_sim_eth_reset(struct ccat_sim *const sim)
+{
+	u32 *const tx_reset = (u32 *) ccat_sim_eth_reg(sim, SIM_ETH_FIFO + 0x8);
+	u32 *const rx_reset =
+	    (u32 *) ccat_sim_eth_reg(sim, SIM_ETH_FIFO + 0x10 + 0x8);
+
+	if (!xchg(tx_reset, ~0U))
+		sim->tx_next = 0;
+	if (!xchg(rx_reset, ~0U))
+		sim->rx_next = 0;
+}
+
+static bool ccat_sim_eth(struct ccat_sim *const sim, const u64 now)
+{
+	struct ccat_sim_frame *const tx = ccat_sim_dma(sim, SIM_ETH_TX_CHAN);
+	struct ccat_sim_frame *const rx = ccat_sim_dma(sim, SIM_ETH_RX_CHAN);
+	bool busy = false;
+
+	if (!tx || !rx)
+		return false;
+
+	ccat_sim_eth_reset(sim);
+	busy |= ccat_sim_eth_tx(sim, tx, rx, now);
+	busy |= ccat_sim_eth_generate(sim, rx, now);
+	return busy;
+}
+
+static u32 ccat_sim_epcs_addr(const u8 *const regs)
+{
+	return bitrev8(regs[SIM_EPCS_ADDR_2]) << 16 |
+	    bitrev8(regs[SIM_EPCS_ADDR_1]) << 8 | bitrev8(regs[SIM_EPCS_ADDR_0]);
+}
+
+static void ccat_sim_epcs_exec(struct ccat_sim *const sim, const u64 now)
+{
+	struct ccat_sim_epcs *const epcs = &sim->epcs;
+	u8 *const regs = sim->bar_0 + SIM_EPCS_ADDR;
+	const u16 clocks =
+	    regs[SIM_EPCS_CLOCKS_HI] << 8 | regs[SIM_EPCS_CLOCKS_LO];
+	const u32 addr = ccat_sim_epcs_addr(regs) % SIM_EPCS_FLASH_SIZE;
+	const size_t len =
+	    min_t(size_t,
+		  clocks > SIM_EPCS_CMD_CLOCKS ?
+		  (clocks - SIM_EPCS_CMD_CLOCKS) / 8 : 0,
+		  min_t(size_t, SIM_EPCS_DATA_MAX, SIM_EPCS_FLASH_SIZE - addr));
+	const bool in_progress = now < epcs->ready;
+	size_t i;
+
+	switch (regs[SIM_EPCS_CMD]) {
+	case SIM_EPCS_READ_FLASH:
+		for (i = 0; i < len; ++i)
+			regs[SIM_EPCS_DATA_IN + 8 * i] = epcs->flash[addr + i];
+		break;
+	case SIM_EPCS_READ_STATUS:
+		regs[SIM_EPCS_STATUS] = in_progress ? SIM_EPCS_STATUS_WIP : 0;
+		break;
+	case SIM_EPCS_GET_PROM_ID:
+		regs[SIM_EPCS_DATA_IN] = SIM_EPCS_PROM_ID;
+		break;
+	case SIM_EPCS_WRITE_ENABLE:
+		epcs->write_enabled = !in_progress;
+		break;
+	case SIM_EPCS_WRITE_FLASH:
+		if (!epcs->write_enabled)
+			break;
+		/* programming only clears bits */
+		for (i = 0; i < len; ++i)
+			epcs->flash[addr + i] &= regs[SIM_EPCS_DATA_OUT + 8 * i];
+		epcs->write_enabled = false;
+		epcs->ready = now + SIM_EPCS_PROGRAM_NS;
+		break;
+	case SIM_EPCS_BULK_ERASE:
+		if (!epcs->write_enabled)
+			break;
+		memset(epcs->flash, 0xff, SIM_EPCS_FLASH_SIZE);
+		epcs->write_enabled = false;
+		epcs->ready = now + (u64) READ_ONCE(erase_ms) * NSEC_PER_MSEC;
+		break;
+	default:
+		pr_debug("%s(): unknown EPCS command 0x%02x\n", __FUNCTION__,
+			 regs[SIM_EPCS_CMD]);
+		break;
+	}
+	epcs->running = true;
+	epcs->done = now + (u64) clocks *SIM_EPCS_NS_PER_CLOCK;
+}
+
+/**
+ * The EPCS busy flag is set while idle. After a command completed, busy is
+ * cleared together with the command register, which ccat_update rewrites
+ * before its next activation. busy is raised again as soon as that write
+ * is seen, so the thread spins while the EPCS function is in use.
+ */
+static bool ccat_sim_epcs(struct ccat_sim *const sim, const u64 now)
+{
+	struct ccat_sim_epcs *const epcs = &sim->epcs;
+	u8 *const regs = sim->bar_0 + SIM_EPCS_ADDR;
+
+	if (epcs->running) {
+		if (now < epcs->done)
+			return true;
+		epcs->running = false;
+		epcs->active_until = now + SIM_EPCS_ACTIVE_NS;
+		WRITE_ONCE(regs[SIM_EPCS_CMD], 0);
+		smp_wmb();
+		WRITE_ONCE(regs[SIM_EPCS_BUSY], 0);
+		return true;
+	}
+
+	if (!READ_ONCE(regs[SIM_EPCS_BUSY]) && READ_ONCE(regs[SIM_EPCS_CMD]))
+		WRITE_ONCE(regs[SIM_EPCS_BUSY], 1);
+
+	if (READ_ONCE(regs[SIM_EPCS_ACTIVATE])) {
+		WRITE_ONCE(regs[SIM_EPCS_ACTIVATE], 0);
+		WRITE_ONCE(regs[SIM_EPCS_BUSY], 1);
+		smp_rmb();
+		ccat_sim_epcs_exec(sim, now);
+		return true;
+	}
+
+	/* nobody waits for an idle EPCS */
+	if (now >= epcs->active_until)
+		WRITE_ONCE(regs[SIM_EPCS_BUSY], 1);
+	return now < epcs->active_until;
+}
+
+static int ccat_sim_thread(void *data)
+{
+	struct ccat_sim *const sim = data;
+	u64 *const systemtime = (u64 *) (sim->bar_0 + SIM_TIME_ADDR);
+
+	while (!kthread_should_stop()) {
+		const u64 now = ktime_get_ns();
+		bool busy;
+
+		WRITE_ONCE(*systemtime, now);
+		busy = ccat_sim_epcs(sim, now);
+
+		mutex_lock(&sim->eth_lock);
+		if (sim->eth_bound)
+			busy |= ccat_sim_eth(sim, now);
+		mutex_unlock(&sim->eth_lock);
+
+		if (busy)
+			cond_resched();
+		else
+			usleep_range(poll_us, 2 * poll_us + 1);
+	}
+	return 0;
+}
+
+/**
+ * The DMA memory of the Ethernet function is owned by ccat_netdev, stop
+ * touching it before the driver unbinds and frees it.
+ */
+static int ccat_sim_notify(struct notifier_block *nb, unsigned long action,
+			   void *data)
+{
+	struct ccat_sim *const sim = container_of(nb, struct ccat_sim, nb);
+	struct device *const dev = data;
+	const struct ccat_function *func;
+
+	if (dev->parent != &sim->pdev->dev || !dev->platform_data)
+		return NOTIFY_DONE;
+	func = dev->platform_data;
+	if (func->info.type != CCATINFO_ETHERCAT_MASTER_DMA)
+		return NOTIFY_DONE;
+
+	mutex_lock(&sim->eth_lock);
+	switch (action) {
+	case BUS_NOTIFY_BOUND_DRIVER:
+		sim->eth_bound = true;
+		break;
+	case BUS_NOTIFY_UNBIND_DRIVER:
+		sim->eth_bound = false;
+		break;
+	}
+	mutex_unlock(&sim->eth_lock);
+	return NOTIFY_OK;
+}
+
+static void ccat_sim_free(struct ccat_sim *const sim)
+{
+	vfree(sim->epcs.flash);
+	vfree(sim->bar_2);
+	vfree(sim->bar_0);
+	kfree(sim);
+}
+
+static int __init ccat_sim_init(void)
+{
+	struct ccat_sim *const sim = kzalloc(sizeof(*sim), GFP_KERNEL);
+	int status;
+
+	if (!sim)
+		return -ENOMEM;
+
+	mutex_init(&sim->eth_lock);
+	sim->bar_0 = vzalloc(SIM_BAR0_SIZE);
+	sim->bar_2 = vzalloc(SIM_BAR2_SIZE);
+	sim->epcs.flash = vmalloc(SIM_EPCS_FLASH_SIZE);
+	if (!sim->bar_0 || !sim->bar_2 || !sim->epcs.flash) {
+		status = -ENOMEM;
+		goto free_sim;
+	}
+	memset(sim->epcs.flash, 0xff, SIM_EPCS_FLASH_SIZE);
+	ccat_sim_build(sim);
+
+	sim->pdev = platform_device_register_simple(KBUILD_MODNAME, -1, NULL, 0);
+	if (IS_ERR(sim->pdev)) {
+		status = PTR_ERR(sim->pdev);
+		goto free_sim;
+	}
+	status = dma_coerce_mask_and_coherent(&sim->pdev->dev, DMA_BIT_MASK(64));
+	if (status) {
+		pr_err("No suitable DMA available.\n");
+		goto unregister_pdev;
+	}
+
+	sim->nb.notifier_call = ccat_sim_notify;
+	status = bus_register_notifier(&platform_bus_type, &sim->nb);
+	if (status)
+		goto unregister_pdev;
+
+	sim->thread = kthread_run(ccat_sim_thread, sim, KBUILD_MODNAME);
+	if (IS_ERR(sim->thread)) {
+		status = PTR_ERR(sim->thread);
+		goto unregister_notifier;
+	}
+
+	sim->ccat.pdev = sim->pdev;
+	sim->ccat.dev = &sim->pdev->dev;
+	sim->ccat.bar_0 = (void __iomem __force *)sim->bar_0;
+	sim->ccat.bar_2 = (void __iomem __force *)sim->bar_2;
+	status = ccat_device_add(&sim->ccat);
+	if (status) {
+		pr_err("register simulated CCAT failed: %d\n", status);
+		goto stop_thread;
+	}
+	ccat_sim = sim;
+	return 0;
+
+stop_thread:
+	kthread_stop(sim->thread);
+unregister_notifier:
+	bus_unregister_notifier(&platform_bus_type, &sim->nb);
+unregister_pdev:
+	platform_device_unregister(sim->pdev);
+free_sim:
+	ccat_sim_free(sim);
+	return status;
+}
+
+static void __exit ccat_sim_exit(void)
+{
+	struct ccat_sim *const sim = ccat_sim;
+
+	ccat_device_remove(&sim->ccat);
+	kthread_stop(sim->thread);
+	bus_unregister_notifier(&platform_bus_type, &sim->nb);
+	platform_device_unregister(sim->pdev);
+	ccat_sim_free(sim);
+}
+
+module_init(ccat_sim_init);
+module_exit(ccat_sim_exit);
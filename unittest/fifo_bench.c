@@ -0,0 +1,382 @@
+// SPDX-License-Identifier: MIT
+/**
+    Network Driver for Beckhoff CCAT communication controller
+    Copyright (C) Beckhoff Automation GmbH & Co. KG
+    Author: Patrick Bruenn <p.bruenn@beckhoff.com>
+*/
+
+/**
+ * Userspace benchmark of the CCAT DMA ring logic in fifo.h. The ring code
+ * of ccat_netdev is compiled against the shims below, a second thread
+ * plays the FPGA: it consumes the doorbells, marks tx slots sent and fills
+ * the rx slots handed to it. The driver side mirrors the fast paths of
+ * __ccat_eth_start_xmit() and poll_rx() without skbs.
+ *
+ * Build with "make bench" and run the result under perf or valgrind. Pin
+ * the threads to separate cores for stable numbers, e.g.:
+ *   taskset -c 2,3 ./unittest/fifo_bench [frames [slots]]
+ * Every frame carries a sequence number, the exit status is non zero if
+ * one was lost or reordered.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* kernel shims used by fifo.h */
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the endian shims assume a little endian host"
+#endif
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef uint16_t __le16;
+typedef uint32_t __le32;
+typedef uint64_t __le64;
+typedef uint64_t dma_addr_t;
+typedef struct {
+	int64_t counter;
+} atomic64_t;
+struct device;
+
+#define __iomem
+#define ____cacheline_aligned_in_smp __attribute__((aligned(64)))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define cpu_to_le16(x) ((__le16)(x))
+#define cpu_to_le32(x) ((__le32)(x))
+#define le16_to_cpu(x) ((u16)(x))
+#define le32_to_cpu(x) ((u32)(x))
+#define le64_to_cpu(x) ((u64)(x))
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define dma_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+
+/* wait for the other thread, yield now and then for machines with one CPU */
+static void sim_relax(void)
+{
+	static __thread unsigned int spins;
+
+	cpu_relax();
+	if (!(++spins % 256))
+		sched_yield();
+}
+
+static void ccat_iowrite32(u32 value, void __iomem * addr);
+#define ccat_writel_relaxed(value, addr) ccat_iowrite32(value, addr)
+
+#include "../fifo.h"
+
+#define SIM_SLOTS 64
+#define SIM_DMA_SIZE (SIM_SLOTS * sizeof(struct ccat_dma_frame))
+#define SIM_DOORBELLS 256
+#define SIM_REG_SIZE 4096
+#define SIM_SEQ_OFFSET 14
+
+/**
+ * struct sim_reg - CCAT TX-FIFO/RX-FIFO register of a simulated fifo
+ * @doorbells: values written to the fifo register, 0 marks a fifo reset
+ * @head: written by the driver
+ * @tail: written by the simulated FPGA
+ *
+ * ccat_iowrite32() finds the register by aligning the address down, so the
+ * reset register at offset 0x8 lands in the same queue.
+ */
+struct sim_reg {
+	u32 doorbells[SIM_DOORBELLS];
+	u32 head ____cacheline_aligned_in_smp;
+	u32 tail ____cacheline_aligned_in_smp;
+} __attribute__((aligned(SIM_REG_SIZE)));
+
+static void ccat_iowrite32(u32 value, void __iomem * addr)
+{
+	struct sim_reg *const reg =
+	    (struct sim_reg *)((uintptr_t) addr & ~(uintptr_t) (SIM_REG_SIZE - 1));
+	const u32 head = reg->head;
+
+	if ((uintptr_t) addr - (uintptr_t) reg == 0x8)
+		value = 0;
+
+	while (head - smp_load_acquire(&reg->tail) >= SIM_DOORBELLS)
+		sim_relax();
+	reg->doorbells[head % SIM_DOORBELLS] = value;
+	smp_store_release(&reg->head, head + 1);
+}
+
+static bool sim_reg_pop(struct sim_reg *const reg, u32 * value)
+{
+	const u32 tail = reg->tail;
+
+	if (tail == smp_load_acquire(&reg->head))
+		return false;
+	*value = reg->doorbells[tail % SIM_DOORBELLS];
+	smp_store_release(&reg->tail, tail + 1);
+	return true;
+}
+
+static const struct ccat_eth_fifo_operations rx_ops = {
+	.add = ccat_eth_rx_fifo_dma_add,
+	.refill = fifo_dma_rx_refill,
+	.ready = fifo_dma_rx_ready,
+};
+
+static const struct ccat_eth_fifo_operations tx_ops = {
+	.add = ccat_eth_tx_fifo_dma_add_free,
+	.sent = fifo_dma_tx_sent,
+};
+
+/**
+ * struct sim - simulated FPGA
+ * @rx/tx: fifos of the driver
+ * @rx_reg/tx_reg: fifo registers
+ * @rx_slots: rx slots handed to the FPGA, in order
+ * @rx_frames: number of frames left to receive
+ * @len: length of received frames
+ * @tx_seq: next expected tx sequence number
+ * @errors: lost or reordered frames
+ * @stop: set by the driver thread to end the simulation
+ */
+struct sim {
+	struct ccat_eth_fifo *rx;
+	struct ccat_eth_fifo *tx;
+	struct sim_reg *rx_reg;
+	struct sim_reg *tx_reg;
+	u32 rx_slots[SIM_SLOTS];
+	u32 rx_slots_head;
+	u32 rx_slots_tail;
+	u64 rx_frames;
+	size_t len;
+	u32 tx_seq;
+	u64 errors;
+	bool stop;
+};
+
+static void sim_tx(struct sim *const sim)
+{
+	u32 value;
+
+	while (sim_reg_pop(sim->tx_reg, &value)) {
+		struct ccat_dma_frame *frame;
+		u32 seq;
+
+		if (!value) {
+			sim->tx_seq = 0;
+			continue;
+		}
+		frame = sim->tx->dma.start +
+		    ((value & 0xffffff) -
+		     offsetof(struct ccat_dma_frame_hdr, length)) /
+		    sizeof(*frame);
+		memcpy(&seq, frame->data + SIM_SEQ_OFFSET, sizeof(seq));
+		sim->errors += (seq != sim->tx_seq++);
+		frame->hdr.timestamp = sim->tx_seq;
+		__atomic_store_n(&frame->hdr.tx_flags, CCAT_FRAME_SENT,
+				 __ATOMIC_RELEASE);
+	}
+}
+
+static void sim_rx(struct sim *const sim, u32 * const seq)
+{
+	u32 value;
+
+	while (sim_reg_pop(sim->rx_reg, &value)) {
+		if (!value) {
+			sim->rx_slots_head = sim->rx_slots_tail = 0;
+			continue;
+		}
+		sim->rx_slots[sim->rx_slots_head++ % SIM_SLOTS] =
+		    (value & ~(1U << 31)) / sizeof(struct ccat_dma_frame);
+	}
+
+	if (sim->rx_frames && sim->rx_slots_tail != sim->rx_slots_head) {
+		struct ccat_dma_frame *const frame = sim->rx->dma.start +
+		    sim->rx_slots[sim->rx_slots_tail++ % SIM_SLOTS];
+
+		memset(frame->data, 0xff, SIM_SEQ_OFFSET);
+		memcpy(frame->data + SIM_SEQ_OFFSET, seq, sizeof(*seq));
+		++*seq;
+		frame->hdr.length = sim->len +
+		    offsetof(struct ccat_dma_frame_hdr, rx_flags);
+		frame->hdr.timestamp = *seq;
+		__atomic_store_n(&frame->hdr.rx_flags, CCAT_FRAME_RECEIVED,
+				 __ATOMIC_RELEASE);
+		--sim->rx_frames;
+	}
+}
+
+static void *sim_thread(void *data)
+{
+	struct sim *const sim = data;
+	u32 rx_seq = 0;
+
+	while (!__atomic_load_n(&sim->stop, __ATOMIC_ACQUIRE)) {
+		sim_tx(sim);
+		sim_rx(sim, &rx_seq);
+		sim_relax();
+	}
+	return NULL;
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fifo_init(struct ccat_eth_fifo *const fifo,
+		      const struct ccat_eth_fifo_operations *const ops,
+		      struct sim_reg *const reg, const u32 slots)
+{
+	memset(fifo, 0, sizeof(*fifo));
+	fifo->ops = ops;
+	fifo->reg = reg;
+	fifo->mask = slots - 1;
+	fifo->max_slots = SIM_SLOTS;
+	fifo->dma.start = aligned_alloc(SIM_REG_SIZE, SIM_DMA_SIZE);
+	if (!fifo->dma.start) {
+		perror("aligned_alloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(fifo->dma.start, 0, SIM_DMA_SIZE);
+}
+
+/**
+ * Send frames like __ccat_eth_start_xmit(), reclaim like poll_tx() once
+ * the ring is full, and wait until the last frame was sent.
+ */
+static u64 bench_tx(struct ccat_eth_fifo *const fifo, const u64 frames,
+		    const size_t len)
+{
+	u8 buf[MAX_PAYLOAD_SIZE] = { 0 };
+	const u64 start = now_ns();
+	u32 seq;
+
+	for (seq = 0; seq < frames; ++seq) {
+		struct ccat_dma_frame *frame;
+
+		while (!ccat_eth_tx_space(fifo)) {
+			ccat_eth_tx_reclaim(fifo);
+			sim_relax();
+		}
+		memcpy(buf + SIM_SEQ_OFFSET, &seq, sizeof(seq));
+		frame = fifo_dma_tx_prepare(fifo, len);
+		memcpy(frame->data, buf, len);
+		ccat_iowrite32(fifo_dma_tx_doorbell(fifo, frame, len), fifo->reg);
+		smp_store_release(&fifo->head, fifo->head + 1);
+	}
+	while (fifo->tail != fifo->head) {
+		ccat_eth_tx_reclaim(fifo);
+		sim_relax();
+	}
+	return now_ns() - start;
+}
+
+/**
+ * Receive frames like poll_rx(), copying each into a buffer like
+ * copy_to_skb, and count lost or reordered frames.
+ */
+static u64 bench_rx(struct ccat_eth_fifo *const fifo, const u64 frames,
+		    const size_t len, u64 * const errors)
+{
+	const u32 watermark = (fifo->mask + 2) / 2;
+	u8 buf[MAX_PAYLOAD_SIZE];
+	const u64 start = now_ns();
+	u32 seq = 0;
+
+	while (seq < frames) {
+		const size_t ready = fifo->ops->ready(fifo);
+		u32 rx_seq;
+
+		if (!ready) {
+			if (fifo->head != fifo->tail)
+				fifo->ops->refill(fifo, fifo->head);
+			sim_relax();
+			continue;
+		}
+		memcpy(buf, fifo_dma_slot(fifo, fifo->head)->data, ready);
+		memcpy(&rx_seq, buf + SIM_SEQ_OFFSET, sizeof(rx_seq));
+		*errors += (ready != len) || (rx_seq != seq);
+		++seq;
+		++fifo->head;
+		if (fifo->head - fifo->tail >= watermark)
+			fifo->ops->refill(fifo, fifo->head);
+	}
+	return now_ns() - start;
+}
+
+static u64 run(const bool rx, const u64 frames, const u32 slots,
+	       const size_t len)
+{
+	static struct sim_reg rx_reg, tx_reg;
+	struct ccat_eth_fifo rx_fifo, tx_fifo;
+	struct sim sim = {
+		.rx = &rx_fifo,
+		.tx = &tx_fifo,
+		.rx_reg = &rx_reg,
+		.tx_reg = &tx_reg,
+		.rx_frames = rx ? frames : 0,
+		.len = len,
+	};
+	pthread_t thread;
+	u64 errors = 0;
+	u64 ns;
+
+	memset(&rx_reg, 0, sizeof(rx_reg));
+	memset(&tx_reg, 0, sizeof(tx_reg));
+	fifo_init(&rx_fifo, &rx_ops, &rx_reg, slots);
+	fifo_init(&tx_fifo, &tx_ops, &tx_reg, slots);
+	ccat_eth_fifo_reset(&rx_fifo);
+	ccat_eth_fifo_reset(&tx_fifo);
+
+	if (pthread_create(&thread, NULL, sim_thread, &sim)) {
+		perror("pthread_create");
+		exit(EXIT_FAILURE);
+	}
+	if (rx)
+		ns = bench_rx(&rx_fifo, frames, len, &errors);
+	else
+		ns = bench_tx(&tx_fifo, frames, len);
+	__atomic_store_n(&sim.stop, true, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+	errors += sim.errors;
+
+	printf("%s len=%4zu slots=%2u frames=%llu ns/frame=%7.1f Mpps=%6.3f%s\n",
+	       rx ? "rx" : "tx", len, slots, (unsigned long long)frames,
+	       (double)ns / frames, frames * 1e3 / ns,
+	       errors ? " ERRORS" : "");
+	free(rx_fifo.dma.start);
+	free(tx_fifo.dma.start);
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t lengths[] = { 60, 128, 256, 512, 1024, 1514 };
+	const u64 frames = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1000000;
+	const u32 slots = (argc > 2) ? strtoul(argv[2], NULL, 0) : SIM_SLOTS;
+	u64 errors = 0;
+	size_t i;
+
+	if (!frames || !slots || slots > SIM_SLOTS || (slots & (slots - 1))) {
+		fprintf(stderr,
+			"usage: %s [frames [slots]], slots a power of two <= %u\n",
+			argv[0], SIM_SLOTS);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+		errors += run(false, frames, slots, lengths[i]);
+		errors += run(true, frames, slots, lengths[i]);
+	}
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
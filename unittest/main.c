@@ -28,12 +28,14 @@
  ****************************************************************************/
 
 #include <errno.h>
+#include <getopt.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <sys/resource.h>
-#include <sys/time.h>
-#include <sys/types.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 /****************************************************************************/
@@ -42,9 +44,28 @@
 
 /****************************************************************************/
 
+/*
+ * Cyclic benchmark for the CCAT EtherCAT path: cycles are timed with
+ * absolute clock_nanosleep() under SCHED_FIFO with locked memory. Wakeup
+ * jitter, send-to-receive latency and working counter failures are
+ * recorded and summarized at exit. Build against the IgH master with:
+ *   gcc -O2 -o cyclic main.c -lethercat
+ */
+
 // Application parameters
-#define FREQUENCY 100
-#define PRIORITY 0
+#define DEFAULT_FREQUENCY 1000
+#define MAX_FREQUENCY 10000
+#define DEFAULT_PRIORITY 80
+#define NSEC_PER_SEC 1000000000LL
+
+// Histograms with 1 us buckets, the last bucket counts all larger values
+#define HIST_BUCKETS 1000
+#define HIST_NS 1000
+
+static unsigned int frequency = DEFAULT_FREQUENCY;
+static int priority = DEFAULT_PRIORITY;
+static unsigned int duration = 10;
+static const char *hist_file = NULL;
 
 /****************************************************************************/
 
@@ -58,9 +79,22 @@ static ec_domain_state_t domain1_state = {};
 static ec_slave_config_t *sc_ana_in = NULL;
 static ec_slave_config_state_t sc_ana_in_state = {};
 
-// Timer
-static unsigned int sig_alarms = 0;
-static unsigned int user_alarms = 0;
+// Cycle statistics
+struct cycle_stat {
+    const char *name;
+    long long min;
+    long long max;
+    long long sum;
+    unsigned long long count;
+    unsigned long long hist[HIST_BUCKETS];
+};
+
+static struct cycle_stat latency = {"send-to-receive latency", NSEC_PER_SEC};
+static struct cycle_stat jitter = {"wakeup jitter", NSEC_PER_SEC};
+static unsigned long long cycles = 0;
+static unsigned long long overruns = 0;
+static unsigned long long wc_failures = 0;
+static volatile sig_atomic_t run = 1;
 
 /****************************************************************************/
 
@@ -240,21 +274,95 @@ void check_slave_config_states(void)
 
 /****************************************************************************/
 
-void cyclic_task()
+static long long now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * NSEC_PER_SEC + t.tv_nsec;
+}
+
+static void stat_add(struct cycle_stat *st, long long ns)
+{
+    const long long bucket = ns / HIST_NS;
+
+    if (ns < st->min)
+        st->min = ns;
+    if (ns > st->max)
+        st->max = ns;
+    st->sum += ns;
+    st->count++;
+    st->hist[(bucket < 0) ? 0 :
+        (bucket >= HIST_BUCKETS) ? HIST_BUCKETS - 1 : bucket]++;
+}
+
+/* upper bound of the bucket, which contains the q quantile */
+static long long stat_quantile(const struct cycle_stat *st, double q)
+{
+    const unsigned long long rank = (unsigned long long)(q * st->count);
+    unsigned long long n = 0;
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS - 1; i++) {
+        n += st->hist[i];
+        if (n > rank)
+            return (long long)(i + 1) * HIST_NS;
+    }
+    return st->max;
+}
+
+static void stat_print(const struct cycle_stat *st)
+{
+    if (!st->count) {
+        printf("%s: no samples\n", st->name);
+        return;
+    }
+    printf("%s: min %lld avg %lld p99 < %lld p99.9 < %lld max %lld ns\n",
+            st->name, st->min, st->sum / (long long)st->count,
+            stat_quantile(st, 0.99), stat_quantile(st, 0.999), st->max);
+}
+
+/****************************************************************************/
+
+/*
+ * Send the process data and busy poll for the frames coming back, so the
+ * send-to-receive latency of the driver is measured within the cycle. The
+ * frames are given up after half a cycle.
+ */
+void cyclic_task(long long period_ns)
 {
     static unsigned int counter = 10;
     static uint8_t outputValue = 0;
     static int numAsyncCycles = 0;
     uint8_t inputValue = 0;
     static uint8_t error = 0;
+    ec_domain_state_t ds;
+    long long sent, now;
+
+    // write process data
+    EC_WRITE_U8(domain1_pd + off_dig_out[0], outputValue);
+    EC_WRITE_U8(domain1_pd + off_dig_out[1], error);
+
+    // send process data
+    ecrt_domain_queue(domain1);
+    ecrt_master_send(master);
+    sent = now_ns();
 
     // receive process data
-    ecrt_master_receive(master);
-    ecrt_domain_process(domain1);
+    do {
+        ecrt_master_receive(master);
+        ecrt_domain_process(domain1);
+        ecrt_domain_state(domain1, &ds);
+        now = now_ns();
+    } while (ds.wc_state != EC_WC_COMPLETE && now - sent < period_ns / 2);
+
+    if (ds.wc_state == EC_WC_COMPLETE)
+        stat_add(&latency, now - sent);
+    else
+        wc_failures++;
 
     // check process data state (optional)
     check_domain1_state();
-    
 
 	inputValue = EC_READ_U8(domain1_pd + off_dig_in[1]) & 0x0F;
 	
@@ -287,26 +395,87 @@ void cyclic_task()
         // check for islave configuration state(s) (optional)
 //        check_slave_config_states();
     }
-
-    // write process data
-    EC_WRITE_U8(domain1_pd + off_dig_out[0], outputValue);
-    EC_WRITE_U8(domain1_pd + off_dig_out[1], error);
-
-    // send process data
-    ecrt_domain_queue(domain1);
-    ecrt_master_send(master);
 }
 
 /****************************************************************************/
 
 void signal_handler(int signum) {
     switch (signum) {
-        case SIGALRM:
-            sig_alarms++;
+        case SIGINT:
+        case SIGTERM:
+            run = 0;
             break;
     }
 }
 
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-f frequency] [-p priority] [-d duration]"
+            " [-H histogram]\n"
+            "  -f  cycles per second, up to %u (default: %u)\n"
+            "  -p  SCHED_FIFO priority, 0 keeps the policy (default: %u)\n"
+            "  -d  seconds to run, 0 runs until SIGINT (default: 10)\n"
+            "  -H  write the histograms (us, latency, jitter) to a file\n",
+            name, MAX_FREQUENCY, DEFAULT_FREQUENCY, DEFAULT_PRIORITY);
+    exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:p:d:H:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                frequency = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                priority = strtol(optarg, NULL, 0);
+                break;
+            case 'd':
+                duration = strtoul(optarg, NULL, 0);
+                break;
+            case 'H':
+                hist_file = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (!frequency || frequency > MAX_FREQUENCY
+            || priority < 0 || priority > sched_get_priority_max(SCHED_FIFO))
+        usage(argv[0]);
+}
+
+static void write_histogram(void)
+{
+    FILE *f = fopen(hist_file, "w");
+    int i;
+
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", hist_file,
+                strerror(errno));
+        return;
+    }
+    fprintf(f, "# us latency jitter\n");
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        if (latency.hist[i] || jitter.hist[i])
+            fprintf(f, "%d %llu %llu\n", i, latency.hist[i], jitter.hist[i]);
+    }
+    fclose(f);
+}
+
+static void print_summary(long long period_ns)
+{
+    printf("\n%llu cycles at %u Hz (%lld ns), %llu overruns,"
+            " %llu working counter failures\n", cycles, frequency,
+            period_ns, overruns, wc_failures);
+    stat_print(&latency);
+    stat_print(&jitter);
+    if (hist_file)
+        write_histogram();
+}
+
 /****************************************************************************/
 
 static int Init_EL100x(int* off, const uint16_t position, const uint16_t index, const uint32_t vendor_id, const uint32_t product_code, const ec_sync_info_t syncs[])
@@ -332,8 +501,10 @@ int main(int argc, char **argv)
 {
     ec_slave_config_t *sc;
     struct sigaction sa;
-    struct itimerval tv;
-    uint16_t i;
+    struct timespec wakeup;
+    long long period_ns, next, end;
+
+    parse_args(argc, argv);
 
     master = ecrt_request_master(0);
     if (!master)
@@ -363,47 +534,49 @@ int main(int argc, char **argv)
         return -1;
     }
 
-#if PRIORITY
-    pid_t pid = getpid();
-    if (setpriority(PRIO_PROCESS, pid, -19))
-        fprintf(stderr, "Warning: Failed to set priority: %s\n",
+    if (mlockall(MCL_CURRENT | MCL_FUTURE))
+        fprintf(stderr, "Warning: Failed to lock memory: %s\n",
                 strerror(errno));
-#endif
+
+    if (priority) {
+        struct sched_param param = {.sched_priority = priority};
+
+        if (sched_setscheduler(0, SCHED_FIFO, &param))
+            fprintf(stderr, "Warning: Failed to set SCHED_FIFO %d: %s\n",
+                    priority, strerror(errno));
+    }
 
     sa.sa_handler = signal_handler;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
-    if (sigaction(SIGALRM, &sa, 0)) {
+    if (sigaction(SIGINT, &sa, 0) || sigaction(SIGTERM, &sa, 0)) {
         fprintf(stderr, "Failed to install signal handler!\n");
         return -1;
     }
 
-    printf("Starting timer...\n");
-    tv.it_interval.tv_sec = 0;
-    tv.it_interval.tv_usec = 1000000 / FREQUENCY;
-    tv.it_value.tv_sec = 0;
-    tv.it_value.tv_usec = 1000;
-    if (setitimer(ITIMER_REAL, &tv, NULL)) {
-        fprintf(stderr, "Failed to start timer: %s\n", strerror(errno));
-        return 1;
-    }
-
     printf("Started.\n");
-    while (1) {
-        pause();
-
-#if 0
-        struct timeval t;
-        gettimeofday(&t, NULL);
-        printf("%u.%06u\n", t.tv_sec, t.tv_usec);
-#endif
-
-        while (sig_alarms != user_alarms) {
-            cyclic_task();
-            user_alarms++;
+    period_ns = NSEC_PER_SEC / frequency;
+    end = duration ? now_ns() + duration * NSEC_PER_SEC : 0;
+    next = now_ns() + period_ns;
+    while (run && (!end || next < end)) {
+        wakeup.tv_sec = next / NSEC_PER_SEC;
+        wakeup.tv_nsec = next % NSEC_PER_SEC;
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL))
+            continue;
+
+        stat_add(&jitter, now_ns() - next);
+        cyclic_task(period_ns);
+        cycles++;
+
+        // skip the cycles we missed
+        next += period_ns;
+        while (next < now_ns()) {
+            next += period_ns;
+            overruns++;
         }
     }
 
+    print_summary(period_ns);
     return 0;
 }
 
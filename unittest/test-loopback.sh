@@ -0,0 +1,13 @@
+#!/bin/bash -l
+
+set -e
+
+echo "$0 running..."
+
+net_id=$(dmesg | grep -oE "ccat.*: registered eth[0-9]+ as network device" | grep -oE "eth[0-9]+" | tail -n 1)
+
+# the self-test switches the port to software loopback, no peer required
+ip link set dev ${net_id} up
+sleep 1
+ethtool -t ${net_id} offline
+echo "$0 done."
@@ -5,9 +5,40 @@
     Author: Patrick Bruenn <p.bruenn@beckhoff.com>
 */
 
-#include <pcap.h>
-#include <stdio.h>
+/**
+ * Frame burst benchmark: send bursts of EtherCAT frames through a raw
+ * AF_PACKET socket, either from a PACKET_MMAP tx ring or with sendmmsg(),
+ * and match the frames echoed by the terminals (or a loopback) on the same
+ * interface. Each frame carries a tag with a sequence number and its
+ * CLOCK_MONOTONIC send time, so the round trip covers both driver paths.
+ *
+ * Reports the achieved tx rate and throughput (frame bytes without
+ * preamble and FCS) and min/avg/p99/p99.9/max round trip time, as text or
+ * as a single JSON object (-j) to track results over time.
+ *
+ * Build with "make unittest/udp_burst" and run as root, e.g.:
+ *   ./udp_burst -i eth2 -s 128 -b 4 -r 10000 -n 100000 -j
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
 
 /**
  * EtherCAT frame to enable forwarding on EtherCAT Terminals
@@ -26,22 +57,479 @@ static const uint8_t frameForwardEthernetFrames[] = {
 	0x00, 0x00
 };
 
-int main()
+#define TAG_OFFSET 32
+#define TAG_MAGIC 0xCCA7B0B5
+#define MIN_FRAME_SIZE 60
+#define MAX_FRAME_SIZE 1514
+#define RING_FRAME_SIZE 2048
+#define RING_BLOCK_SIZE (8 * RING_FRAME_SIZE)
+#define RING_BLOCKS 32
+#define RING_FRAMES (RING_BLOCKS * RING_BLOCK_SIZE / RING_FRAME_SIZE)
+#define MAX_BURST RING_FRAMES
+#define RX_BATCH 64
+
+/**
+ * struct tag - identifies a frame of this run, placed in the padding
+ * behind the EtherCAT datagram, which the terminals pass unchanged
+ */
+struct tag {
+	uint32_t magic;
+	uint32_t run;
+	uint64_t seq;
+	uint64_t tx_ns;
+} __attribute__((packed));
+
+struct config {
+	const char *ifname;
+	size_t size;
+	unsigned int burst;
+	uint64_t rate;
+	uint64_t count;
+	unsigned int timeout_ms;
+	uint16_t ethertype;
+	bool sendmmsg;
+	bool json;
+};
+
+struct rx_state {
+	const struct config *cfg;
+	int fd;
+	uint32_t run;
+	uint64_t *rtt;
+	uint64_t received;
+	uint64_t foreign;
+	volatile bool stop;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-i ifname] [-s size] [-b burst] [-r rate] [-n count]\n"
+		"          [-t timeout_ms] [-e ethertype] [-m mmap|sendmmsg] [-j]\n"
+		"  -i  interface (default: eth2)\n"
+		"  -s  frame size %d..%d bytes without FCS (default: %d)\n"
+		"  -b  frames per burst, up to %d (default: 1)\n"
+		"  -r  frames per second, 0 sends as fast as possible (default: 0)\n"
+		"  -n  number of frames (default: 1000)\n"
+		"  -t  wait for echoes after the last burst (default: 1000 ms)\n"
+		"  -e  EtherType (default: 0x88a4)\n"
+		"  -m  tx path (default: mmap)\n"
+		"  -j  print results as JSON\n", name, MIN_FRAME_SIZE,
+		MAX_FRAME_SIZE, MIN_FRAME_SIZE, MAX_BURST);
+	exit(EXIT_FAILURE);
+}
+
+static void parse_args(int argc, char *argv[], struct config *cfg)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:s:b:r:n:t:e:m:jh")) != -1) {
+		switch (opt) {
+		case 'i':
+			cfg->ifname = optarg;
+			break;
+		case 's':
+			cfg->size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			cfg->burst = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			cfg->rate = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			cfg->count = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg->timeout_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			cfg->ethertype = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			if (!strcmp(optarg, "sendmmsg"))
+				cfg->sendmmsg = true;
+			else if (strcmp(optarg, "mmap"))
+				usage(argv[0]);
+			break;
+		case 'j':
+			cfg->json = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (cfg->size < MIN_FRAME_SIZE || cfg->size > MAX_FRAME_SIZE
+	    || !cfg->burst || cfg->burst > MAX_BURST || !cfg->count)
+		usage(argv[0]);
+}
+
+static int open_socket(const struct config *cfg, int ifindex,
+		       uint16_t protocol)
 {
+	struct sockaddr_ll addr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(protocol),
+		.sll_ifindex = ifindex,
+	};
+	const int fd = socket(AF_PACKET, SOCK_RAW, htons(protocol));
+
+	if (fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "bind to %s failed: %s\n", cfg->ifname,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+static void build_frame(const struct config *cfg, const uint8_t * mac,
+			uint8_t * frame)
+{
+	memset(frame, 0, cfg->size);
+	memcpy(frame, frameForwardEthernetFrames,
+	       sizeof(frameForwardEthernetFrames));
+	memcpy(frame + ETH_ALEN, mac, ETH_ALEN);
+	frame[12] = cfg->ethertype >> 8;
+	frame[13] = cfg->ethertype & 0xff;
+}
+
+static void tag_frame(uint8_t * frame, uint32_t run, uint64_t seq)
+{
+	const struct tag tag = {
+		.magic = TAG_MAGIC,
+		.run = run,
+		.seq = seq,
+		.tx_ns = now_ns(),
+	};
+
+	memcpy(frame + TAG_OFFSET, &tag, sizeof(tag));
+}
+
+static void *rx_thread(void *data)
+{
+	struct rx_state *const rx = data;
+	static uint8_t bufs[RX_BATCH][RING_FRAME_SIZE];
+	struct sockaddr_ll addrs[RX_BATCH];
+	struct iovec iovs[RX_BATCH];
+	struct mmsghdr msgs[RX_BATCH];
+	struct pollfd pfd = {.fd = rx->fd,.events = POLLIN };
 	int i;
-	char pcap_errbuf[PCAP_ERRBUF_SIZE];
-	pcap_errbuf[0]='\0';
-	pcap_t* pcap=pcap_open_live("eth2", 96, 0, 0, pcap_errbuf);
-	if (pcap_errbuf[0]!='\0') {
-		fprintf(stderr,"%s",pcap_errbuf);
-	}
-	if (!pcap) {
-		return 1;
-	}
-	for (i = 0; i < 1000; ++i) {
-		if (pcap_inject(pcap,&frameForwardEthernetFrames,sizeof(frameForwardEthernetFrames))==-1) {
-			pcap_perror(pcap,0);
+
+	for (i = 0; i < RX_BATCH; ++i) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = sizeof(bufs[i]);
+	}
+
+	while (!rx->stop) {
+		int n;
+
+		if (poll(&pfd, 1, 10) <= 0)
+			continue;
+
+		for (i = 0; i < RX_BATCH; ++i) {
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		n = recvmmsg(rx->fd, msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+		const uint64_t now = now_ns();
+
+		for (i = 0; i < n; ++i) {
+			struct tag tag;
+
+			if (addrs[i].sll_pkttype == PACKET_OUTGOING)
+				continue;
+			if (msgs[i].msg_len < TAG_OFFSET + sizeof(tag)) {
+				++rx->foreign;
+				continue;
+			}
+			memcpy(&tag, bufs[i] + TAG_OFFSET, sizeof(tag));
+			if (tag.magic != TAG_MAGIC || tag.run != rx->run
+			    || tag.seq >= rx->cfg->count || rx->rtt[tag.seq]) {
+				++rx->foreign;
+				continue;
+			}
+			rx->rtt[tag.seq] = (now - tag.tx_ns) ? : 1;
+			__atomic_add_fetch(&rx->received, 1, __ATOMIC_RELEASE);
 		}
 	}
-	pcap_close(pcap);
+	return NULL;
+}
+
+/**
+ * struct tx_ring - PACKET_MMAP tx ring with TPACKET_V2 headers
+ */
+struct tx_ring {
+	uint8_t *map;
+	size_t next;
+};
+
+static void tx_ring_init(int fd, struct tx_ring *ring)
+{
+	const int version = TPACKET_V2;
+	struct tpacket_req req = {
+		.tp_block_size = RING_BLOCK_SIZE,
+		.tp_block_nr = RING_BLOCKS,
+		.tp_frame_size = RING_FRAME_SIZE,
+		.tp_frame_nr = RING_FRAMES,
+	};
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version,
+		       sizeof(version))
+	    || setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req))) {
+		perror("PACKET_TX_RING");
+		exit(EXIT_FAILURE);
+	}
+	ring->map = mmap(NULL, RING_BLOCKS * RING_BLOCK_SIZE,
+			 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring->map == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	ring->next = 0;
+}
+
+static void send_burst_mmap(int fd, struct tx_ring *ring,
+			    const struct config *cfg, const uint8_t * frame,
+			    uint32_t run, uint64_t seq, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; ++i) {
+		struct tpacket2_hdr *const hdr =
+		    (void *)(ring->map + ring->next * RING_FRAME_SIZE);
+		uint8_t *const data = (uint8_t *) hdr + TPACKET2_HDRLEN -
+		    sizeof(struct sockaddr_ll);
+
+		while (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) !=
+		       TP_STATUS_AVAILABLE) {
+			struct pollfd pfd = {.fd = fd,.events = POLLOUT };
+
+			if (hdr->tp_status == TP_STATUS_WRONG_FORMAT) {
+				fprintf(stderr, "tx ring: wrong format\n");
+				exit(EXIT_FAILURE);
+			}
+			poll(&pfd, 1, 1);
+		}
+		memcpy(data, frame, cfg->size);
+		tag_frame(data, run, seq + i);
+		hdr->tp_len = cfg->size;
+		__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST,
+				 __ATOMIC_RELEASE);
+		ring->next = (ring->next + 1) % RING_FRAMES;
+	}
+	if (send(fd, NULL, 0, 0) < 0 && errno != ENOBUFS) {
+		perror("send");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void send_burst_mmsg(int fd, const struct config *cfg,
+			    const uint8_t * frame, uint32_t run, uint64_t seq,
+			    unsigned int n)
+{
+	static uint8_t bufs[MAX_BURST][MAX_FRAME_SIZE];
+	struct iovec iovs[MAX_BURST];
+	struct mmsghdr msgs[MAX_BURST];
+	unsigned int i, sent = 0;
+
+	memset(msgs, 0, n * sizeof(msgs[0]));
+	for (i = 0; i < n; ++i) {
+		memcpy(bufs[i], frame, cfg->size);
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = cfg->size;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	for (i = 0; i < n; ++i)
+		tag_frame(bufs[i], run, seq + i);
+	while (sent < n) {
+		const int ret = sendmmsg(fd, msgs + sent, n - sent, 0);
+
+		if (ret < 0) {
+			if (errno == ENOBUFS || errno == EAGAIN)
+				continue;
+			perror("sendmmsg");
+			exit(EXIT_FAILURE);
+		}
+		sent += ret;
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a;
+	const uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t * sorted, size_t n, double q)
+{
+	size_t i = (size_t)(q * n + 0.999999);
+
+	return n ? sorted[(i ? i : 1) - 1] : 0;
+}
+
+static void report(const struct config *cfg, const struct rx_state *rx,
+		   uint64_t tx_ns)
+{
+	uint64_t *const sorted = malloc(cfg->count * sizeof(*sorted));
+	const double pps = cfg->count * 1e9 / (tx_ns ? tx_ns : 1);
+	const double mbps = pps * cfg->size * 8 / 1e6;
+	uint64_t i, n = 0, sum = 0;
+	uint64_t min, avg, p99, p999, max;
+
+	if (!sorted) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < cfg->count; ++i) {
+		if (rx->rtt[i]) {
+			sorted[n++] = rx->rtt[i];
+			sum += rx->rtt[i];
+		}
+	}
+	qsort(sorted, n, sizeof(*sorted), cmp_u64);
+	min = n ? sorted[0] : 0;
+	max = n ? sorted[n - 1] : 0;
+	avg = n ? sum / n : 0;
+	p99 = percentile(sorted, n, 0.99);
+	p999 = percentile(sorted, n, 0.999);
+	free(sorted);
+
+	if (cfg->json) {
+		printf("{\"interface\":\"%s\",\"mode\":\"%s\",\"frame_size\":%zu,"
+		       "\"burst\":%u,\"rate\":%llu,\"sent\":%llu,"
+		       "\"received\":%llu,\"lost\":%llu,\"foreign\":%llu,"
+		       "\"duration_ns\":%llu,\"pps\":%.1f,\"mbps\":%.3f,"
+		       "\"rtt_ns\":{\"min\":%llu,\"avg\":%llu,\"p99\":%llu,"
+		       "\"p99.9\":%llu,\"max\":%llu}}\n", cfg->ifname,
+		       cfg->sendmmsg ? "sendmmsg" : "mmap", cfg->size,
+		       cfg->burst, (unsigned long long)cfg->rate,
+		       (unsigned long long)cfg->count, (unsigned long long)n,
+		       (unsigned long long)(cfg->count - n),
+		       (unsigned long long)rx->foreign,
+		       (unsigned long long)tx_ns, pps, mbps,
+		       (unsigned long long)min, (unsigned long long)avg,
+		       (unsigned long long)p99, (unsigned long long)p999,
+		       (unsigned long long)max);
+		return;
+	}
+	printf("%s: %s, %zu bytes, burst %u, rate %llu\n", cfg->ifname,
+	       cfg->sendmmsg ? "sendmmsg" : "mmap", cfg->size, cfg->burst,
+	       (unsigned long long)cfg->rate);
+	printf("sent %llu received %llu lost %llu foreign %llu\n",
+	       (unsigned long long)cfg->count, (unsigned long long)n,
+	       (unsigned long long)(cfg->count - n),
+	       (unsigned long long)rx->foreign);
+	printf("tx %.1f pps %.3f Mbit/s in %.3f ms\n", pps, mbps, tx_ns / 1e6);
+	printf("rtt ns min %llu avg %llu p99 %llu p99.9 %llu max %llu\n",
+	       (unsigned long long)min, (unsigned long long)avg,
+	       (unsigned long long)p99, (unsigned long long)p999,
+	       (unsigned long long)max);
+}
+
+int main(int argc, char *argv[])
+{
+	struct config cfg = {
+		.ifname = "eth2",
+		.size = MIN_FRAME_SIZE,
+		.burst = 1,
+		.count = 1000,
+		.timeout_ms = 1000,
+		.ethertype = 0x88a4,
+	};
+	struct rx_state rx = { 0 };
+	struct tx_ring ring = { 0 };
+	struct ifreq ifr = { 0 };
+	uint8_t frame[MAX_FRAME_SIZE];
+	pthread_t thread;
+	uint64_t seq, start, next, deadline, tx_ns;
+	const int rcvbuf = 16 * 1024 * 1024;
+	int ifindex, tx_fd;
+
+	parse_args(argc, argv, &cfg);
+
+	ifindex = if_nametoindex(cfg.ifname);
+	if (!ifindex) {
+		fprintf(stderr, "unknown interface %s\n", cfg.ifname);
+		return EXIT_FAILURE;
+	}
+
+	/* bound to protocol 0 the tx socket doesn't receive anything */
+	tx_fd = open_socket(&cfg, ifindex, 0);
+	strncpy(ifr.ifr_name, cfg.ifname, IFNAMSIZ - 1);
+	if (ioctl(tx_fd, SIOCGIFHWADDR, &ifr)) {
+		perror("SIOCGIFHWADDR");
+		return EXIT_FAILURE;
+	}
+	build_frame(&cfg, (uint8_t *) ifr.ifr_hwaddr.sa_data, frame);
+	if (!cfg.sendmmsg)
+		tx_ring_init(tx_fd, &ring);
+
+	rx.cfg = &cfg;
+	rx.fd = open_socket(&cfg, ifindex, cfg.ethertype);
+	/* absorb unpaced bursts, the kernel caps this at rmem_max */
+	setsockopt(rx.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	rx.run = getpid() ^ (uint32_t) now_ns();
+	rx.rtt = calloc(cfg.count, sizeof(*rx.rtt));
+	if (!rx.rtt) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+	if (pthread_create(&thread, NULL, rx_thread, &rx)) {
+		perror("pthread_create");
+		return EXIT_FAILURE;
+	}
+
+	start = next = now_ns();
+	for (seq = 0; seq < cfg.count; seq += cfg.burst) {
+		const unsigned int n = (cfg.count - seq < cfg.burst) ?
+		    cfg.count - seq : cfg.burst;
+
+		if (cfg.rate) {
+			const struct timespec ts = {
+				.tv_sec = next / 1000000000ULL,
+				.tv_nsec = next % 1000000000ULL,
+			};
+
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+					NULL);
+			next += n * 1000000000ULL / cfg.rate;
+		}
+		if (cfg.sendmmsg)
+			send_burst_mmsg(tx_fd, &cfg, frame, rx.run, seq, n);
+		else
+			send_burst_mmap(tx_fd, &ring, &cfg, frame, rx.run, seq,
+					n);
+	}
+	tx_ns = now_ns() - start;
+
+	deadline = now_ns() + cfg.timeout_ms * 1000000ULL;
+	while (__atomic_load_n(&rx.received, __ATOMIC_ACQUIRE) < cfg.count
+	       && now_ns() < deadline)
+		usleep(1000);
+	rx.stop = true;
+	pthread_join(thread, NULL);
+
+	report(&cfg, &rx, tx_ns);
+	close(rx.fd);
+	close(tx_fd);
+	free(rx.rtt);
+	return (rx.received == cfg.count) ? EXIT_SUCCESS : EXIT_FAILURE;
 }